@@ -1,5 +1,10 @@
 // dua_core.cpp - Core functionality implementation
 #include "dua_core.h"
+#include <csignal>
+#ifdef __linux__
+#include <sched.h>
+#include <sys/sysmacros.h>
+#endif
 
 // Format size based on configuration
 std::string format_size(uintmax_t bytes, const std::string& format) {
@@ -79,6 +84,15 @@ uintmax_t get_size_on_disk([[maybe_unused]] const fs::path& path, uintmax_t file
     return ((file_size + block_size - 1) / block_size) * block_size;
 }
 
+uintmax_t get_size_on_disk(const EntryStat& st) {
+#ifdef __linux__
+    return st.blocks * 512;
+#else
+    const uintmax_t block_size = 4096;
+    return ((st.size + block_size - 1) / block_size) * block_size;
+#endif
+}
+
 // Glob pattern matching
 bool glob_match(const std::string& pattern, const std::string& text) {
     std::string regex_pattern;
@@ -118,6 +132,14 @@ bool glob_match(const std::string& pattern, const std::string& text) {
     }
 }
 
+size_t step_ops_limit(size_t current, bool raise) {
+    // Up by a quarter and down by a fifth, so the two undo each other
+    if (raise) {
+        return current + std::max<size_t>(1, current / 4);
+    }
+    return std::max(MIN_POLITE_OPS, current - std::min(current, std::max<size_t>(1, current / 5)));
+}
+
 // Helper function to shorten paths for display
 std::string shorten_path(const std::string& path, size_t max_length) {
     if (path.length() <= max_length) {
@@ -136,140 +158,800 @@ std::string shorten_path(const std::string& path, size_t max_length) {
            path.substr(path.length() - suffix_len);
 }
 
+// WorkDeque implementation
+WorkDeque::WorkDeque(size_t min_capacity) {
+    size_t cap = 64;
+    while (cap < min_capacity) cap <<= 1;
+    capacity = static_cast<int64_t>(cap);
+    slots = std::make_unique<Slot[]>(cap);
+}
+
+void WorkDeque::load(int64_t index, Task& task) const {
+    const Slot& slot = slots[index & (capacity - 1)];
+    for (size_t i = 0; i < Task::WORDS; ++i) {
+        task.words[i] = slot.words[i].load(std::memory_order_relaxed);
+    }
+}
+
+bool WorkDeque::push(const Task& task) {
+    int64_t b = bottom.load(std::memory_order_relaxed);
+    int64_t t = top.load(std::memory_order_acquire);
+    if (b - t >= capacity) {
+        return false;
+    }
+    
+    Slot& slot = slots[b & (capacity - 1)];
+    for (size_t i = 0; i < Task::WORDS; ++i) {
+        slot.words[i].store(task.words[i], std::memory_order_relaxed);
+    }
+    // Release so a thief that sees the new bottom also sees the task and
+    // anything it points to
+    bottom.store(b + 1, std::memory_order_release);
+    return true;
+}
+
+bool WorkDeque::pop(Task& task) {
+    int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+    bottom.store(b, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t t = top.load(std::memory_order_relaxed);
+    
+    if (t > b) {
+        bottom.store(b + 1, std::memory_order_relaxed);
+        return false;
+    }
+    
+    load(b, task);
+    if (t == b) {
+        // Last task, race the thieves for it
+        bool won = top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                               std::memory_order_relaxed);
+        bottom.store(b + 1, std::memory_order_relaxed);
+        return won;
+    }
+    return true;
+}
+
+bool WorkDeque::steal(Task& task) {
+    int64_t t = top.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t b = bottom.load(std::memory_order_acquire);
+    if (t >= b) {
+        return false;
+    }
+    
+    load(t, task);
+    return top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                       std::memory_order_relaxed);
+}
+
+size_t WorkDeque::size_hint() const {
+    int64_t b = bottom.load(std::memory_order_relaxed);
+    int64_t t = top.load(std::memory_order_relaxed);
+    return b > t ? static_cast<size_t>(b - t) : 0;
+}
+
 // WorkStealingThreadPool implementation
-bool WorkStealingThreadPool::try_steal(size_t thief_id, std::function<void()>& task) {
+thread_local size_t WorkStealingThreadPool::worker_index = SIZE_MAX;
+thread_local const WorkStealingThreadPool* WorkStealingThreadPool::worker_pool = nullptr;
+
+void WorkStealingThreadPool::submit(const Task& task) {
+    if (worker_pool == this) {
+        // Workers keep their own subtasks. A full deque means there is
+        // plenty to steal already, so the task is set aside rather than run
+        // inline, which would nest whole scans on this thread's stack.
+        pending_tasks.fetch_add(1, std::memory_order_relaxed);
+        if (!queues[worker_index]->push(task)) {
+            spills[worker_index].tasks.push_back(task);
+            spilled_total.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+    } else {
+        std::lock_guard<std::mutex> lock(injected_mutex);
+        pending_tasks.fetch_add(1, std::memory_order_relaxed);
+        injected.push_back(task);
+        injected_size++;
+    }
+    
+    // Pairs with the fence in park(): either the sleeper sees the task or
+    // we see the sleeper
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (sleeping_workers.load(std::memory_order_relaxed) > 0) {
+        wake_one();
+    }
+}
+
+void WorkStealingThreadPool::wake_one() {
+    {
+        std::lock_guard<std::mutex> lock(park_mutex);
+        wake_epoch.fetch_add(1, std::memory_order_relaxed);
+    }
+    park_cv.notify_one();
+}
+
+void WorkStealingThreadPool::finish_task() {
+    if (pending_tasks.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        std::lock_guard<std::mutex> lock(done_mutex);
+        done_cv.notify_all();
+    }
+}
+
+bool WorkStealingThreadPool::has_visible_work() const {
+    if (injected_size.load(std::memory_order_relaxed) > 0) {
+        return true;
+    }
+    for (const auto& queue : queues) {
+        if (queue->size_hint() > 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool WorkStealingThreadPool::take_spilled(size_t id, Task& task) {
+    auto& tasks = spills[id].tasks;
+    if (tasks.empty()) {
+        return false;
+    }
+    
+    // Newest first, as the deque would have run them; the rest of the batch
+    // goes back into the deque in the same order so it can be stolen
+    task = tasks.back();
+    tasks.pop_back();
+    size_t first = tasks.size() - std::min(tasks.size(), refill_batch);
+    size_t moved = first;
+    while (moved < tasks.size() && queues[id]->push(tasks[moved])) {
+        ++moved;
+    }
+    tasks.erase(tasks.begin() + first, tasks.begin() + moved);
+    if (tasks.empty()) {
+        tasks.shrink_to_fit();
+    }
+    
+    if (moved > first) {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (sleeping_workers.load(std::memory_order_relaxed) > 0) {
+            wake_one();
+        }
+    }
+    return true;
+}
+
+bool WorkStealingThreadPool::take_injected(Task& task) {
+    if (injected_size.load(std::memory_order_relaxed) == 0) {
+        return false;
+    }
+    
+    std::lock_guard<std::mutex> lock(injected_mutex);
+    if (injected.empty()) {
+        return false;
+    }
+    task = injected.front();
+    injected.pop_front();
+    injected_size--;
+    return true;
+}
+
+bool WorkStealingThreadPool::try_steal(size_t thief_id, Task& task) {
     const size_t actual_threads = queues.size();
+    if (actual_threads < 2) {
+        return false;
+    }
+    
+    // Random victims first, then one sweep so nothing is missed
+    thread_local uint64_t rng = 0x9E3779B97F4A7C15ULL * (thief_id + 1);
+    for (size_t attempt = 0; attempt < actual_threads; ++attempt) {
+        rng ^= rng << 13;
+        rng ^= rng >> 7;
+        rng ^= rng << 17;
+        size_t victim_id = rng % actual_threads;
+        if (victim_id != thief_id && queues[victim_id]->steal(task)) {
+            return true;
+        }
+    }
     for (size_t i = 1; i < actual_threads; ++i) {
         size_t victim_id = (thief_id + i) % actual_threads;
-        auto& victim_queue = queues[victim_id];
-        
-        if (victim_queue->size.load() > 0) {
-            std::unique_lock<std::mutex> lock(victim_queue->mutex, std::try_to_lock);
-            if (lock.owns_lock() && !victim_queue->tasks.empty()) {
-                task = std::move(victim_queue->tasks.back());
-                victim_queue->tasks.pop_back();
-                victim_queue->size--;
-                return true;
-            }
+        if (queues[victim_id]->size_hint() > 0 && queues[victim_id]->steal(task)) {
+            return true;
         }
     }
     return false;
 }
 
+void WorkStealingThreadPool::park() {
+    uint64_t ticket = wake_epoch.load(std::memory_order_relaxed);
+    sleeping_workers.fetch_add(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    
+    // Re-check after announcing ourselves so a concurrent submit can't be missed
+    if (!has_visible_work()) {
+        std::unique_lock<std::mutex> lock(park_mutex);
+        park_cv.wait(lock, [&] {
+            return stop.load() || wake_epoch.load(std::memory_order_relaxed) != ticket;
+        });
+    }
+    sleeping_workers.fetch_sub(1, std::memory_order_relaxed);
+}
+
 void WorkStealingThreadPool::worker_thread(size_t id) {
+    worker_index = id;
+    worker_pool = this;
     auto& my_queue = queues[id];
+    if (idle_priority && !make_thread_idle()) {
+        idle_error.store(errno, std::memory_order_relaxed);
+    }
     
     while (!stop) {
-        std::function<void()> task;
+        Task task;
         
-        {
-            std::unique_lock<std::mutex> lock(my_queue->mutex);
-            if (!my_queue->tasks.empty()) {
-                task = std::move(my_queue->tasks.front());
-                my_queue->tasks.pop_front();
-                my_queue->size--;
-            }
+        // Sit out while the controller wants fewer workers; set-aside
+        // tasks are this worker's alone, so they are finished first
+        if (adaptive && id >= active_workers.load(std::memory_order_relaxed) && 
+            spills[id].tasks.empty()) {
+            std::unique_lock<std::mutex> lock(park_mutex);
+            active_cv.wait(lock, [&] {
+                return stop.load() || id < active_workers.load(std::memory_order_relaxed);
+            });
+            continue;
         }
         
-        if (!task && !try_steal(id, task)) {
-            std::unique_lock<std::mutex> lock(global_mutex);
-            work_available.wait_for(lock, std::chrono::milliseconds(10),
-                [this] { return stop.load() || total_tasks.load() > 0; });
+        if (!my_queue->pop(task) && !take_spilled(id, task) && !take_injected(task) && 
+            !try_steal(id, task)) {
+            park();
             continue;
         }
         
-        if (task) {
-            active_workers++;
-            task();
-            active_workers--;
-            total_tasks--;
+        task();
+        finish_task();
+    }
+}
+
+// CPUs this process may run on: the affinity mask, lowered to a cgroup v2
+// cpu.max quota set anywhere up its cgroup path
+static size_t available_cpus(bool& cgroup_capped) {
+    size_t cpus = std::thread::hardware_concurrency();
+    if (cpus == 0) cpus = 4;
+    cgroup_capped = false;
+    
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) == 0 && CPU_COUNT(&set) > 0) {
+        cpus = std::min(cpus, static_cast<size_t>(CPU_COUNT(&set)));
+    }
+    
+    std::ifstream self("/proc/self/cgroup");
+    std::string line;
+    std::string group;
+    while (std::getline(self, line)) {
+        if (line.compare(0, 3, "0::") == 0) {
+            group = line.substr(3);
+        }
+    }
+    if (group.empty()) {
+        return cpus;
+    }
+    
+    std::string relative = (group == "/") ? "" : group;
+    while (true) {
+        std::ifstream max_file("/sys/fs/cgroup" + relative + "/cpu.max");
+        std::string quota;
+        uint64_t period = 0;
+        if (max_file >> quota >> period && quota != "max" && period > 0) {
+            try {
+                size_t allowed = std::max<size_t>(1, (std::stoull(quota) + period - 1) / period);
+                if (allowed < cpus) {
+                    cpus = allowed;
+                    cgroup_capped = true;
+                }
+            } catch (...) {
+            }
         }
+        if (relative.empty()) break;
+        relative.resize(relative.rfind('/'));
     }
+#endif
+    return cpus;
 }
 
-WorkStealingThreadPool::WorkStealingThreadPool(size_t threads) {
+WorkStealingThreadPool::WorkStealingThreadPool(size_t threads, bool idle) {
     num_threads = threads;
+    idle_priority = idle;
     if (num_threads == 0) {
-        num_threads = std::thread::hardware_concurrency();
-        if (num_threads == 0) num_threads = 4;
+        num_threads = available_cpus(cgroup_capped);
+        adaptive = true;
     }
     
 #ifdef __APPLE__
     num_threads = std::min(num_threads, size_t(3));
 #endif
+    adaptive = adaptive && num_threads > 1;
+    active_workers.store(num_threads, std::memory_order_relaxed);
+    meters = std::make_unique<WorkMeter[]>(num_threads + 1);
     
     queues.reserve(num_threads);
     for (size_t i = 0; i < num_threads; ++i) {
-        queues.emplace_back(std::make_unique<WorkQueue>());
+        queues.emplace_back(std::make_unique<WorkDeque>(QUEUE_SIZE_LIMIT / num_threads));
     }
+    spills = std::make_unique<SpillList[]>(num_threads);
+    // Refilling half a deque leaves room for the subtasks those tasks spawn
+    refill_batch = std::max<size_t>(1, QUEUE_SIZE_LIMIT / num_threads / 2);
     
     workers.reserve(num_threads);
     for (size_t i = 0; i < num_threads; ++i) {
         workers.emplace_back(&WorkStealingThreadPool::worker_thread, this, i);
     }
+    if (adaptive) {
+        controller = std::thread(&WorkStealingThreadPool::control_loop, this);
+    }
 }
 
 WorkStealingThreadPool::~WorkStealingThreadPool() {
-    stop = true;
-    work_available.notify_all();
+    {
+        std::lock_guard<std::mutex> lock(park_mutex);
+        stop = true;
+    }
+    park_cv.notify_all();
+    active_cv.notify_all();
+    {
+        std::lock_guard<std::mutex> lock(controller_mutex);
+    }
+    controller_cv.notify_all();
     for (auto& worker : workers) {
         worker.join();
     }
+    if (controller.joinable()) {
+        controller.join();
+    }
+}
+
+void WorkStealingThreadPool::record_work(size_t items, uint64_t latency_ns) {
+    WorkMeter& meter = meters[worker_pool == this ? worker_index : num_threads];
+    meter.items.fetch_add(items, std::memory_order_relaxed);
+    meter.latency_ns.fetch_add(latency_ns, std::memory_order_relaxed);
+    meter.units.fetch_add(1, std::memory_order_relaxed);
+}
+
+void WorkStealingThreadPool::set_active(size_t count, double items_per_sec, double latency_ms) {
+    {
+        std::lock_guard<std::mutex> lock(park_mutex);
+        active_workers.store(count, std::memory_order_relaxed);
+    }
+    active_cv.notify_all();
+    
+    std::lock_guard<std::mutex> lock(history_mutex);
+    if (history.size() == MAX_HISTORY) {
+        history.erase(history.begin());
+    }
+    history.push_back({std::chrono::steady_clock::now(), count, items_per_sec, latency_ms});
+}
+
+std::vector<WorkStealingThreadPool::ConcurrencyChange> 
+WorkStealingThreadPool::concurrency_history() const {
+    std::lock_guard<std::mutex> lock(history_mutex);
+    return history;
+}
+
+void WorkStealingThreadPool::control_loop() {
+    // Hill climbing on throughput: keep adding workers while each one
+    // still buys more than KNEE_GAIN, keep shedding them while that costs
+    // less, and step back from the first move that doesn't pay. A move
+    // that raises latency per unit much faster than throughput is treated
+    // as a loss too (the device queue is saturating).
+    uint64_t last_items = 0;
+    uint64_t last_latency = 0;
+    uint64_t last_units = 0;
+    double last_rate = 0;
+    double last_unit_latency = 0;
+    int last_step = 0;
+    int hold = 0;
+    auto last_tick = std::chrono::steady_clock::now();
+    
+    std::unique_lock<std::mutex> lock(controller_mutex);
+    while (!controller_cv.wait_for(lock, CONTROL_INTERVAL, [this] { return stop.load(); })) {
+        uint64_t items = 0;
+        uint64_t latency = 0;
+        uint64_t units = 0;
+        for (size_t i = 0; i <= num_threads; ++i) {
+            items += meters[i].items.load(std::memory_order_relaxed);
+            latency += meters[i].latency_ns.load(std::memory_order_relaxed);
+            units += meters[i].units.load(std::memory_order_relaxed);
+        }
+        auto now = std::chrono::steady_clock::now();
+        double seconds = std::chrono::duration<double>(now - last_tick).count();
+        uint64_t interval_units = units - last_units;
+        double rate = (items - last_items) / seconds;
+        double unit_latency = interval_units > 0 
+            ? (latency - last_latency) / 1e6 / interval_units : 0;
+        last_items = items;
+        last_latency = latency;
+        last_units = units;
+        last_tick = now;
+        
+        // Only an interval busy from start to end says anything
+        if (pending_tasks.load(std::memory_order_relaxed) == 0 || interval_units == 0) {
+            last_rate = 0;
+            last_step = 0;
+            continue;
+        }
+        
+        size_t active = active_workers.load(std::memory_order_relaxed);
+        int step = 0;
+        if (last_step != 0 && last_rate > 0) {
+            double gain = rate / last_rate;
+            double slowdown = last_unit_latency > 0 ? unit_latency / last_unit_latency : 1;
+            bool paid = gain > 1 + KNEE_GAIN && slowdown < 2 * gain;
+            bool cost = gain < 1 - KNEE_GAIN;
+            if (last_step > 0) {
+                step = paid ? 1 : -1;
+            } else {
+                step = cost ? 1 : -1;
+            }
+            // Turning around means the knee was just crossed: settle there
+            if (step != last_step) {
+                hold = HOLD_INTERVALS;
+            }
+        } else if (hold > 0) {
+            hold--;
+        } else if (last_rate > 0) {
+            step = active < num_threads ? 1 : -1;
+        }
+        
+        size_t next = active;
+        if (step > 0 && active < num_threads) {
+            next = active + 1;
+        } else if (step < 0 && active > 1) {
+            next = active - 1;
+        }
+        if (next != active) {
+            set_active(next, rate, unit_latency);
+        }
+        // A corrective step is not judged again; the hold follows it
+        last_step = (next != active && hold == 0) ? step : 0;
+        last_rate = rate;
+        last_unit_latency = unit_latency;
+    }
 }
 
 void WorkStealingThreadPool::wait_all() {
-    while (total_tasks.load() > 0 || active_workers.load() > 0) {
-        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    std::unique_lock<std::mutex> lock(done_mutex);
+    done_cv.wait(lock, [this] {
+        return pending_tasks.load(std::memory_order_acquire) == 0;
+    });
+}
+
+// ScanWatchdog implementation
+static void watchdog_signal_handler(int) {
+    // Only here so the blocked syscall returns EINTR
+}
+
+static int64_t steady_now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+ScanWatchdog::ScanWatchdog(size_t workers, std::chrono::milliseconds timeout)
+    : slot_count(workers + 1), deadline(timeout) {
+    slots = std::make_unique<Slot[]>(slot_count);
+    
+    static std::once_flag handler_installed;
+    std::call_once(handler_installed, [] {
+        struct sigaction sa;
+        std::memset(&sa, 0, sizeof(sa));
+        sa.sa_handler = watchdog_signal_handler;
+        sigemptyset(&sa.sa_mask);
+        sa.sa_flags = 0;  // No SA_RESTART, interrupted reads must return
+        sigaction(SIGURG, &sa, nullptr);
+    });
+    
+    monitor = std::thread(&ScanWatchdog::monitor_loop, this);
+}
+
+ScanWatchdog::~ScanWatchdog() {
+    {
+        std::lock_guard<std::mutex> lock(monitor_mutex);
+        stop = true;
     }
+    monitor_cv.notify_all();
+    monitor.join();
 }
 
-// InodeKey implementation
-bool OptimizedScanner::InodeKey::operator==(const InodeKey& other) const {
-    return device == other.device && inode == other.inode;
+ScanWatchdog::Token ScanWatchdog::begin() {
+    size_t idx = std::min(WorkStealingThreadPool::current_worker(), slot_count - 1);
+    Slot& slot = slots[idx];
+    uint64_t generation = next_generation.fetch_add(1);
+    
+    slot.thread = pthread_self();
+    slot.started_ns.store(steady_now_ns(), std::memory_order_relaxed);
+    slot.active.store(generation, std::memory_order_release);
+    return Token{idx, ReadCancel{&slot.abandoned, generation, &slot.started_ns}};
 }
 
-std::size_t OptimizedScanner::InodeKeyHash::operator()(const InodeKey& k) const {
-    return std::hash<dev_t>()(k.device) ^ (std::hash<ino_t>()(k.inode) << 1);
+void ScanWatchdog::end(const Token& token) {
+    slots[token.slot].active.store(0, std::memory_order_release);
 }
 
-// OptimizedScanner implementation
-OptimizedScanner::OptimizedScanner(WorkStealingThreadPool& tp, Config& cfg) 
-    : pool(tp), config(cfg), progress_throttle(std::chrono::milliseconds(100)) {
-    start_time = std::chrono::steady_clock::now();
+void ScanWatchdog::monitor_loop() {
+    auto period = std::clamp(deadline / 4, std::chrono::milliseconds(50), 
+                             std::chrono::milliseconds(500));
+    const int64_t deadline_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(deadline).count();
+    
+    std::unique_lock<std::mutex> lock(monitor_mutex);
+    while (!stop) {
+        monitor_cv.wait_for(lock, period);
+        if (stop) break;
+        
+        int64_t now = steady_now_ns();
+        for (size_t i = 0; i < slot_count; ++i) {
+            Slot& slot = slots[i];
+            uint64_t generation = slot.active.load(std::memory_order_acquire);
+            if (generation == 0 || slot.abandoned.load() == generation) continue;
+            if (now - slot.started_ns.load(std::memory_order_relaxed) < deadline_ns) continue;
+            if (slot.active.load(std::memory_order_acquire) != generation) continue;
+            
+            slot.abandoned.store(generation);
+            timeouts++;
+            pthread_kill(slot.thread, SIGURG);
+        }
+    }
+}
+
+// ConcurrentInodeSet implementation
+static constexpr ConcurrentInodeSet::Key EMPTY_INODE_KEY{UINT64_MAX, UINT64_MAX};
+
+ConcurrentInodeSet::ConcurrentInodeSet(size_t threads) {
+    shard_count = 16;
+    while (shard_count < threads * 4 && shard_count < 1024) shard_count <<= 1;
+    shard_shift = 64;
+    for (size_t n = shard_count; n > 1; n >>= 1) shard_shift--;
+    shards = std::make_unique<Shard[]>(shard_count);
 }
 
-bool OptimizedScanner::should_count_entry(const Entry& entry) {
-    if (!config.count_hard_links && entry.hard_link_count > 1) {
-        std::lock_guard<std::mutex> lock(inode_mutex);
-        InodeKey key{entry.device_id, entry.inode};
-        auto it = inode_map.find(key);
-        if (it != inode_map.end()) {
+uint64_t ConcurrentInodeSet::hash(const Key& key) {
+    // splitmix64 finalizer over both fields
+    uint64_t x = key.inode ^ (key.device * 0x9E3779B97F4A7C15ULL);
+    x ^= x >> 30;
+    x *= 0xBF58476D1CE4E5B9ULL;
+    x ^= x >> 27;
+    x *= 0x94D049BB133111EBULL;
+    x ^= x >> 31;
+    return x;
+}
+
+void ConcurrentInodeSet::grow(Shard& shard, size_t min_count) {
+    // Keep the table at most half full
+    size_t capacity = shard.slots.empty() ? 64 : shard.slots.size();
+    while (capacity < min_count * 2) capacity <<= 1;
+    if (capacity == shard.slots.size()) return;
+    
+    std::vector<Key> old(capacity, EMPTY_INODE_KEY);
+    old.swap(shard.slots);
+    shard.count = 0;
+    for (const Key& key : old) {
+        if (key.device != EMPTY_INODE_KEY.device || key.inode != EMPTY_INODE_KEY.inode) {
+            insert_locked(shard, key, hash(key));
+        }
+    }
+}
+
+bool ConcurrentInodeSet::insert_locked(Shard& shard, const Key& key, uint64_t h) {
+    if ((shard.count + 1) * 2 > shard.slots.size()) {
+        grow(shard, shard.count + 1);
+    }
+    
+    size_t mask = shard.slots.size() - 1;
+    for (size_t i = h & mask;; i = (i + 1) & mask) {
+        Key& slot = shard.slots[i];
+        if (slot.device == key.device && slot.inode == key.inode) {
             return false;
         }
-        inode_map[key] = 1;
+        if (slot.device == EMPTY_INODE_KEY.device && slot.inode == EMPTY_INODE_KEY.inode) {
+            slot = key;
+            shard.count++;
+            return true;
+        }
     }
+}
+
+void ConcurrentInodeSet::lock(Shard& shard, std::unique_lock<std::mutex>& guard) {
+    guard = std::unique_lock<std::mutex>(shard.mutex, std::try_to_lock);
+    if (!guard.owns_lock()) {
+        guard.lock();
+        shard.contended++;
+    }
+    shard.acquisitions++;
+}
+
+bool ConcurrentInodeSet::insert(const Key& key) {
+    uint64_t h = hash(key);
+    Shard& shard = shards[h >> shard_shift];
+    std::unique_lock<std::mutex> guard;
+    lock(shard, guard);
+    return insert_locked(shard, key, h);
+}
+
+void ConcurrentInodeSet::insert_batch(const std::vector<Key>& keys, std::vector<char>& inserted) {
+    inserted.assign(keys.size(), 0);
+    if (keys.empty()) return;
+    
+    // Order the batch by shard so each lock is taken once
+    thread_local std::vector<std::pair<uint64_t, uint32_t>> order;
+    order.clear();
+    for (size_t i = 0; i < keys.size(); ++i) {
+        order.emplace_back(hash(keys[i]), static_cast<uint32_t>(i));
+    }
+    std::sort(order.begin(), order.end(), [this](const auto& a, const auto& b) {
+        return (a.first >> shard_shift) < (b.first >> shard_shift);
+    });
+    
+    for (size_t begin = 0; begin < order.size();) {
+        size_t shard_id = order[begin].first >> shard_shift;
+        size_t end = begin;
+        while (end < order.size() && (order[end].first >> shard_shift) == shard_id) end++;
+        
+        Shard& shard = shards[shard_id];
+        std::unique_lock<std::mutex> guard;
+        lock(shard, guard);
+        grow(shard, shard.count + (end - begin));
+        for (size_t i = begin; i < end; ++i) {
+            inserted[order[i].second] = insert_locked(shard, keys[order[i].second], order[i].first);
+        }
+        begin = end;
+    }
+}
+
+bool ConcurrentInodeSet::erase(const Key& key) {
+    auto empty = [](const Key& slot) {
+        return slot.device == EMPTY_INODE_KEY.device && slot.inode == EMPTY_INODE_KEY.inode;
+    };
+    uint64_t h = hash(key);
+    Shard& shard = shards[h >> shard_shift];
+    std::unique_lock<std::mutex> guard;
+    lock(shard, guard);
+    if (shard.slots.empty()) return false;
+    
+    size_t mask = shard.slots.size() - 1;
+    size_t hole = h & mask;
+    for (;; hole = (hole + 1) & mask) {
+        const Key& slot = shard.slots[hole];
+        if (empty(slot)) return false;
+        if (slot.device == key.device && slot.inode == key.inode) break;
+    }
+    
+    // Pull later keys of the run back over the hole unless that would put
+    // them before their home slot, so probes still reach every key
+    for (size_t i = (hole + 1) & mask; !empty(shard.slots[i]); i = (i + 1) & mask) {
+        size_t home = hash(shard.slots[i]) & mask;
+        bool stays = hole <= i ? (hole < home && home <= i) : (hole < home || home <= i);
+        if (!stays) {
+            shard.slots[hole] = shard.slots[i];
+            hole = i;
+        }
+    }
+    shard.slots[hole] = EMPTY_INODE_KEY;
+    shard.count--;
     return true;
 }
 
-bool OptimizedScanner::should_ignore_directory(const fs::path& path) {
-    fs::path canonical_path;
-    try {
-        canonical_path = fs::canonical(path);
-    } catch (...) {
-        canonical_path = path;
+size_t ConcurrentInodeSet::size() const {
+    size_t total = 0;
+    for (size_t i = 0; i < shard_count; ++i) {
+        std::lock_guard<std::mutex> guard(shards[i].mutex);
+        total += shards[i].count;
+    }
+    return total;
+}
+
+void ConcurrentInodeSet::clear() {
+    for (size_t i = 0; i < shard_count; ++i) {
+        std::lock_guard<std::mutex> guard(shards[i].mutex);
+        std::vector<Key>().swap(shards[i].slots);
+        shards[i].count = 0;
+    }
+}
+
+size_t ConcurrentInodeSet::lock_acquisitions() const {
+    size_t total = 0;
+    for (size_t i = 0; i < shard_count; ++i) {
+        std::lock_guard<std::mutex> guard(shards[i].mutex);
+        total += shards[i].acquisitions;
+    }
+    return total;
+}
+
+size_t ConcurrentInodeSet::lock_contentions() const {
+    size_t total = 0;
+    for (size_t i = 0; i < shard_count; ++i) {
+        std::lock_guard<std::mutex> guard(shards[i].mutex);
+        total += shards[i].contended;
+    }
+    return total;
+}
+
+// OptimizedScanner implementation
+static std::atomic<uint64_t> next_scanner_id{1};
+// Entries this thread has run through scan_directory_batch, for measuring
+// the work each directory took
+static thread_local size_t entries_handled = 0;
+
+OptimizedScanner::OptimizedScanner(WorkStealingThreadPool& tp, Config& cfg, NodeStore& nodes) 
+    : pool(tp), config(cfg), store(nodes), progress_throttle(std::chrono::milliseconds(100)),
+      watchdog(tp.size(), cfg.fs_timeout), seen_inodes(tp.size()), visited_dirs(tp.size()),
+      ops_cap(cfg.polite_ops),
+      instance_id(next_scanner_id.fetch_add(1, std::memory_order_relaxed)) {
+    start_time = std::chrono::steady_clock::now();
+    record_stamps = !config.save_snapshot_path.empty();
+    
+    for (const auto& dir : config.ignore_dirs) {
+        EntryStat st;
+        if (stat_entry(dir, st)) {
+            ignored_dirs.push_back({static_cast<uint64_t>(st.device), 
+                                    static_cast<uint64_t>(st.inode)});
+        }
     }
     
-    {
-        std::lock_guard<std::mutex> lock(visited_mutex);
-        if (!visited_dirs.insert(canonical_path.string()).second) {
-            return true;
+    for (const auto& [mount, limit] : config.device_limits) {
+        EntryStat st;
+        if (stat_entry(mount, st)) {
+            device_overrides.push_back({st.device, limit});
+        }
+    }
+    
+    if (config.stat_engine == "io_uring") {
+#ifdef __linux__
+        std::string reason;
+        use_io_uring = IoUringStatx::supported(reason);
+        if (!use_io_uring) {
+            engine_note = "io_uring unavailable (" + reason + ")";
+        }
+#else
+        engine_note = "io_uring unavailable on this platform";
+#endif
+    }
+}
+
+void OptimizedScanner::mark_counted(const std::vector<EntryStat>& stats, 
+                                    const std::vector<char>& ok,
+                                    std::vector<char>& counted) {
+    counted.assign(stats.size(), 1);
+    if (config.count_hard_links) return;
+    
+    // Only files with more than one link can be seen twice
+    thread_local std::vector<ConcurrentInodeSet::Key> keys;
+    thread_local std::vector<size_t> slots;
+    thread_local std::vector<char> inserted;
+    keys.clear();
+    slots.clear();
+    for (size_t i = 0; i < stats.size(); ++i) {
+        if (ok[i] && stats[i].type == DirEntryType::Regular && stats[i].nlink > 1) {
+            keys.push_back({static_cast<uint64_t>(stats[i].device), 
+                            static_cast<uint64_t>(stats[i].inode)});
+            slots.push_back(i);
         }
     }
+    if (keys.empty()) return;
     
-    return config.ignore_dirs.find(canonical_path) != config.ignore_dirs.end();
+    seen_inodes.insert_batch(keys, inserted);
+    for (size_t j = 0; j < slots.size(); ++j) {
+        if (!inserted[j]) {
+            counted[slots[j]] = 0;
+            hard_link_duplicates++;
+        }
+    }
 }
 
-void OptimizedScanner::update_progress() const {
+bool OptimizedScanner::should_scan_directory(const EntryStat& st) {
+    ConcurrentInodeSet::Key key{static_cast<uint64_t>(st.device), 
+                                static_cast<uint64_t>(st.inode)};
+    for (const auto& ignored : ignored_dirs) {
+        if (ignored.device == key.device && ignored.inode == key.inode) {
+            return false;
+        }
+    }
+    return visited_dirs.insert(key);
+}
+
+void OptimizedScanner::update_progress() {
     if (config.show_progress && progress_throttle.should_update()) {
         size_t current_entries = entries_traversed.load();
         size_t skipped = skipped_entries.load();
@@ -285,187 +967,733 @@ void OptimizedScanner::update_progress() const {
         if (skipped > 0) {
             std::cerr << " (skipped " << skipped << ")";
         }
+        if (ops_limiter.limited()) {
+            std::cerr << " at " << static_cast<size_t>(ops_limiter.measured()) << " ops/s (cap "
+                      << static_cast<size_t>(ops_limiter.limit()) << ")";
+        }
         std::cerr << " - " << shortened << std::flush;
     }
 }
 
-bool OptimizedScanner::try_iterate_directory(const fs::path& dir_path, 
-                          std::vector<fs::directory_entry>& entries) {
+bool OptimizedScanner::try_iterate_directory(const fs::path& dir_path, DirListing& listing,
+                                             const ReadCancel& cancel) {
     try {
-        auto future = std::async(std::launch::async, [&]() {
-            try {
-                for (const auto& entry : fs::directory_iterator(dir_path,
-                        fs::directory_options::skip_permission_denied)) {
-                    entries.push_back(entry);
-                }
-                return true;
-            } catch (...) {
-                return false;
+        return listing.read(dir_path, cancel, &ops_limiter);
+    } catch (...) {
+        return false;
+    }
+}
+
+void OptimizedScanner::stat_batch(int dir_fd, const std::vector<DirRecord>& batch,
+                                  std::vector<EntryStat>& stats, std::vector<char>& ok,
+                                  const ReadCancel& cancel) {
+    if (use_io_uring && stat_batch_io_uring(dir_fd, batch, stats, ok, cancel)) {
+        return;
+    }
+    
+    stats.assign(batch.size(), EntryStat{});
+    ok.assign(batch.size(), 0);
+    for (size_t i = 0; i < batch.size(); ++i) {
+        // Symlinks are never followed and trusted directories stat their
+        // own fd later, so the dirent type is enough
+        if (skips_stat(batch[i])) {
+            stats[i].type = batch[i].type;
+            ok[i] = 1;
+        } else {
+            ops_limiter.acquire(1, cancel);
+            bool done;
+            while (!(done = stat_entry_at(dir_fd, batch[i].name, stats[i])) && 
+                   errno == EINTR && !cancel.requested()) {
             }
-        });
-        
-        if (future.wait_for(FS_TIMEOUT) == std::future_status::ready) {
-            return future.get();
+            ok[i] = done ? 1 : 0;
+            if (!done && cancel.requested()) break;
+        }
+    }
+}
+
+bool OptimizedScanner::stat_batch_io_uring([[maybe_unused]] int dir_fd,
+                                           [[maybe_unused]] const std::vector<DirRecord>& batch,
+                                           [[maybe_unused]] std::vector<EntryStat>& stats,
+                                           [[maybe_unused]] std::vector<char>& ok,
+                                           [[maybe_unused]] const ReadCancel& cancel) {
+#ifdef __linux__
+    // One ring per worker thread, set up on first use
+    thread_local std::unique_ptr<IoUringStatx> ring;
+    thread_local bool ring_failed = false;
+    thread_local std::vector<const char*> names;
+    thread_local std::vector<size_t> slots;
+    thread_local std::vector<EntryStat> ring_stats;
+    thread_local std::vector<char> ring_ok;
+    
+    if (!ring && !ring_failed) {
+        ring = std::make_unique<IoUringStatx>();
+        if (!ring->init(BATCH_SIZE)) {
+            ring.reset();
+            ring_failed = true;
+        }
+    }
+    if (!ring) {
+        engine_fallbacks++;
+        return false;
+    }
+    
+    stats.assign(batch.size(), EntryStat{});
+    ok.assign(batch.size(), 0);
+    names.clear();
+    slots.clear();
+    for (size_t i = 0; i < batch.size(); ++i) {
+        if (skips_stat(batch[i])) {
+            stats[i].type = batch[i].type;
+            ok[i] = 1;
         } else {
-            skipped_entries++;
-            return false;
+            names.push_back(batch[i].name);
+            slots.push_back(i);
         }
-    } catch (...) {
+    }
+    
+    // The ring takes the whole batch at once, so it is paid for up front
+    if (!names.empty()) {
+        ops_limiter.acquire(names.size(), cancel);
+    }
+    // A cancelled batch keeps what finished; the rest fails and the
+    // directory is marked incomplete like on the sync path
+    if (!ring->stat_batch(dir_fd, names, ring_stats, ring_ok, cancel) && ring->broken()) {
+        ring.reset();
+        ring_failed = true;
+        engine_fallbacks++;
         return false;
     }
+    for (size_t j = 0; j < slots.size(); ++j) {
+        stats[slots[j]] = ring_stats[j];
+        ok[slots[j]] = ring_ok[j];
+    }
+    return true;
+#else
+    return false;
+#endif
 }
 
-void OptimizedScanner::scan_directory_batch(std::shared_ptr<Entry> parent, 
-                        const std::vector<fs::directory_entry>& batch,
-                        dev_t root_device) {
-    for (const auto& item : batch) {
-        try {
-            auto child = std::make_shared<Entry>(item.path());
-            
-            {
-                std::lock_guard<std::mutex> lock(current_path_mutex);
-                current_path = item.path().string();
+static DirStamp stamp_of(const EntryStat& st) {
+    return {st.mtime_sec, st.ctime_sec, st.mtime_nsec, st.ctime_nsec};
+}
+
+bool OptimizedScanner::scan_directory_batch(ScanState& state, 
+                        const std::vector<DirRecord>& batch,
+                        int dir_fd, dev_t root_device,
+                        const ReadCancel& cancel,
+                        const PreviousDirs& previous_dirs,
+                        NodeStore::ChildChain* chain) {
+    if (cancel.requested()) {
+        return false;
+    }
+    entries_handled += batch.size();
+    
+    // Collect metadata for the whole batch first, then build the nodes
+    std::vector<EntryStat> stats;
+    std::vector<char> ok;
+    std::vector<char> counted;
+    stat_batch(dir_fd, batch, stats, ok, cancel);
+    mark_counted(stats, ok, counted);
+    
+    const size_t worker = WorkStealingThreadPool::current_worker();
+    const NodeId parent = state.node;
+    const bool totals_only = keep_depth >= 0 && state.depth >= static_cast<uint32_t>(keep_depth);
+    uint64_t batch_size = 0;
+    uint64_t batch_entries = 0;
+    bool complete = true;
+    
+    for (size_t i = 0; i < batch.size(); ++i) {
+        const auto& item = batch[i];
+        const EntryStat& st = stats[i];
+        
+        if (!ok[i]) {
+            if (cancel.requested()) {
+                complete = false;
+                break;
             }
+            io_errors++;
+            continue;
+        }
+        
+        bool is_symlink = (st.type == DirEntryType::Symlink);
+        if (!is_symlink && config.stay_on_filesystem && st.device != root_device) {
+            continue;
+        }
+        
+        entries_traversed++;
+        update_progress();
+        
+        if (is_symlink) {
+            symlink_count++;
+            if (totals_only) continue;
+            NodeId child = store.create(worker, parent, item.name, NODE_SYMLINK, chain);
             
-            if (!child->is_symlink && config.stay_on_filesystem && 
-                child->device_id != root_device) {
-                continue;
+            char target[4096];
+            ops_limiter.acquire(1, cancel);
+            ssize_t len = readlinkat(dir_fd, item.name, target, sizeof(target));
+            if (len >= 0) {
+                store.set_symlink_target(worker, child, std::string_view(target, len));
             }
-            
-            entries_traversed++;
-            update_progress();
-            
-            if (child->is_symlink) {
-                symlink_count++;
-                child->size = 0;
-                child->apparent_size = 0;
-                child->entry_count = 0;
-                
-                {
-                    std::lock_guard<std::mutex> lock(parent->children_mutex);
-                    parent->children.push_back(child);
+        } else if (st.type == DirEntryType::Directory) {
+            dir_count++;
+            // Without a stat, the child checks itself once it is opened
+            const bool unverified = trust_dirent && item.type == DirEntryType::Directory;
+            NodeId child = INVALID_NODE;
+            if (!totals_only) {
+                child = store.create(worker, parent, item.name, NODE_DIRECTORY, chain);
+                store[child].mtime = st.mtime_sec;
+                if (record_stamps && !unverified) {
+                    store.set_stamp(worker, child, stamp_of(st));
                 }
-            } else if (item.is_directory()) {
-                child->is_directory = true;
-                dir_count++;
-                
-                {
-                    std::lock_guard<std::mutex> lock(parent->children_mutex);
-                    parent->children.push_back(child);
+            }
+            
+            if (unverified || should_scan_directory(st)) {
+                auto* child_state = new ScanState(child, &state);
+                child_state->stamp = stamp_of(st);
+                child_state->unverified = unverified;
+                child_state->device = unverified ? state.device : st.device;
+                if (!previous_dirs.empty()) {
+                    auto it = previous_dirs.find(item.name);
+                    if (it != previous_dirs.end()) {
+                        child_state->previous = it->second;
+                    }
                 }
-                
-                pool.enqueue([this, child, root_device]() {
-                    scan_directory_impl(child, root_device);
-                });
-            } else if (item.is_regular_file()) {
-                child->apparent_size = item.file_size();
-                
-                if (should_count_entry(*child)) {
-                    if (config.apparent_size) {
-                        child->size = child->apparent_size.load();
-                    } else {
-                        child->size = get_size_on_disk(child->path, child->apparent_size);
+                if (totals_only) {
+                    child_state->path.reserve(state.path.size() + std::strlen(item.name) + 1);
+                    child_state->path = state.path;
+                    if (child_state->path.back() != '/') {
+                        child_state->path += '/';
                     }
-                    file_count++;
-                    parent->entry_count++;
+                    child_state->path += item.name;
                 }
-                
-                {
-                    std::lock_guard<std::mutex> lock(parent->children_mutex);
-                    parent->children.push_back(child);
+                state.pending.fetch_add(1, std::memory_order_relaxed);
+                pool.enqueue([this, child_state, root_device]() {
+                    scan_directory_impl(child_state, root_device);
+                });
+            }
+        } else if (st.type == DirEntryType::Regular) {
+            // Incremental rescans must stat these again to see their inodes
+            const uint32_t link_flag = st.nlink > 1 ? uint32_t{NODE_HARDLINK} : 0u;
+            if (!counted[i]) {
+                if (!totals_only) {
+                    NodeId child = store.create(worker, parent, item.name, 
+                                                NODE_DUPLICATE | link_flag, chain);
+                    store[child].mtime = st.mtime_sec;
                 }
-                
-                parent->size += child->size.load();
+                continue;
+            }
+            
+            uint64_t size = config.apparent_size ? st.size : get_size_on_disk(st);
+            batch_size += size;
+            batch_entries += size > 0 ? 1 : 0;
+            file_count++;
+            
+            if (!totals_only) {
+                Node& node = store[store.create(worker, parent, item.name, link_flag, chain)];
+                node.mtime = st.mtime_sec;
+                node.size = size;
+                node.entry_count = size > 0 ? 1 : 0;
             }
-        } catch (const fs::filesystem_error&) {
+        }
+    }
+    
+    state.size.fetch_add(batch_size, std::memory_order_relaxed);
+    state.entry_count.fetch_add(batch_entries, std::memory_order_relaxed);
+    return complete;
+}
+
+bool OptimizedScanner::scan_records(ScanState& state, const DirListing& listing,
+                                    size_t first, size_t last, dev_t root_device,
+                                    const ReadCancel& cancel, const PreviousDirs& previous_dirs,
+                                    NodeStore::ChildChain* chain) {
+    bool complete = true;
+    std::vector<DirRecord> batch;
+    batch.reserve(BATCH_SIZE);
+    
+    listing.for_each_in(first, last, [&](const DirRecord& item) {
+        if (!complete) return;
+        batch.push_back(item);
+        
+        if (batch.size() >= BATCH_SIZE) {
+            complete = scan_directory_batch(state, batch, listing.fd(), root_device, cancel,
+                                            previous_dirs, chain);
+            batch.clear();
+        }
+    });
+    
+    if (complete && !batch.empty()) {
+        complete = scan_directory_batch(state, batch, listing.fd(), root_device, cancel,
+                                        previous_dirs, chain);
+    }
+    return complete;
+}
+
+bool OptimizedScanner::list_directory(ScanState& state, const fs::path& dir_path,
+                                      dev_t root_device, const ReadCancel& cancel,
+                                      const PreviousDirs& previous_dirs, bool& requeued) {
+    auto listing = std::make_unique<DirListing>();
+    if (!try_iterate_directory(dir_path, *listing, cancel)) {
+        io_errors++;
+        return true;
+    }
+    
+    if (state.unverified) {
+        // The parent only saw a directory record; settle what its stat
+        // would have told it before going through the entries
+        EntryStat st;
+        ops_limiter.acquire(1, cancel);
+        bool have_stat = listing->fd() >= 0 ? stat_entry_fd(listing->fd(), st) 
+                                            : stat_entry(dir_path, st);
+        if (!have_stat) {
             io_errors++;
+            return true;
+        }
+        state.stamp = stamp_of(st);
+        if (state.node != INVALID_NODE) {
+            store[state.node].mtime = st.mtime_sec;
+            if (record_stamps) {
+                store.set_late_stamp(state.node, state.stamp);
+            }
+        }
+        if (!should_scan_directory(st)) {
+            return true;
+        }
+        // It was admitted on its parent's device; a mount point belongs
+        // in its own device's queue
+        state.unverified = false;
+        if (st.device != state.device) {
+            release(state.device);
+            state.device = st.device;
+            if (!admit(&state)) {
+                requeued = true;
+                return true;
+            }
         }
     }
+    
+    if (listing->truncated()) {
+        return false;
+    }
+    
+    size_t chunks = stat_chunks(state, *listing);
+    if (chunks > 1) {
+        split_directory(state, std::move(listing), chunks, root_device, previous_dirs);
+        return true;
+    }
+    return scan_records(state, *listing, 0, listing->parts(), root_device, cancel, 
+                        previous_dirs, nullptr);
 }
 
-void OptimizedScanner::scan_directory_impl(std::shared_ptr<Entry> entry, dev_t root_device) {
-    if (entry->is_symlink || should_ignore_directory(entry->path)) {
-        return;
+size_t OptimizedScanner::stat_chunks(const ScanState& state, const DirListing& listing) {
+    // Only worth it with idle hands to take the chunks and enough entries
+    // to keep each of them busy for a while, and never on a device that
+    // is held to a few directories at once
+    if (pool.size() < 2 || listing.size() < SPLIT_DIR_ENTRIES || 
+        device_queue(state.device).limit != 0) {
+        return 1;
     }
+    return std::min({listing.size() / STAT_CHUNK_ENTRIES, listing.parts(), pool.size() * 4});
+}
+
+void OptimizedScanner::split_directory(ScanState& state, std::unique_ptr<DirListing> listing,
+                                       size_t chunks, dev_t root_device,
+                                       const PreviousDirs& previous_dirs) {
+    auto* split = new SplitListing();
+    split->state = &state;
+    split->listing = std::move(listing);
+    split->previous_dirs = previous_dirs;
+    split->root_device = root_device;
+    split->remaining.store(chunks, std::memory_order_relaxed);
+    dirs_split++;
     
-    {
-        std::lock_guard<std::mutex> lock(current_path_mutex);
-        current_path = entry->path.string();
+    const size_t parts = split->listing->parts();
+    state.pending.fetch_add(static_cast<uint32_t>(chunks), std::memory_order_relaxed);
+    for (size_t i = 0; i < chunks; ++i) {
+        uint32_t first = static_cast<uint32_t>(i * parts / chunks);
+        uint32_t last = static_cast<uint32_t>((i + 1) * parts / chunks);
+        pool.enqueue([this, split, first, last]() {
+            scan_chunk(split, first, last);
+        });
     }
+}
+
+void OptimizedScanner::scan_chunk(SplitListing* split, size_t first, size_t last) {
+    ScanState& state = *split->state;
     
-    std::vector<fs::directory_entry> entries;
-    entries.reserve(BATCH_SIZE * 2);
+    // Children go onto a chain of their own and are linked in once, so
+    // chunks never touch the directory's child list concurrently
+    NodeStore::ChildChain chain;
+    auto started = std::chrono::steady_clock::now();
+    size_t handled_before = entries_handled;
+    auto token = watchdog.begin();
+    bool complete = scan_records(state, *split->listing, first, last, split->root_device,
+                                 token.cancel, split->previous_dirs, &chain);
+    watchdog.end(token);
+    record_work(started, handled_before);
+    
+    if (!complete && !state.incomplete.exchange(true, std::memory_order_relaxed)) {
+        skipped_entries++;
+    }
+    if (state.node != INVALID_NODE) {
+        std::lock_guard<std::mutex> lock(splice_mutex);
+        store.splice_children(state.node, chain);
+    }
     
-    if (!try_iterate_directory(entry->path, entries)) {
+    if (split->remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        delete split;
+    }
+    finish_directory(&state);
+}
+
+bool OptimizedScanner::directory_unchanged(NodeId previous_dir, const DirStamp& now) const {
+    const Node& old = (*previous)[previous_dir];
+    if (!old.is_directory() || old.is_symlink() || old.is_incomplete()) {
+        return false;
+    }
+    
+    DirStamp then;
+    if (!previous->find_stamp(previous_dir, then) || !(then == now)) {
+        return false;
+    }
+    // A change in the second the previous scan started, or later, may have
+    // landed after that scan listed the directory
+    return now.mtime_sec < previous_started && now.ctime_sec < previous_started;
+}
+
+bool OptimizedScanner::reuse_directory(ScanState& state, const fs::path& dir_path,
+                                       dev_t root_device, const ReadCancel& cancel,
+                                       const PreviousDirs& previous_dirs) {
+    // Like DirListing: a directory swapped for a symlink is not followed
+    ops_limiter.acquire(1, cancel);
+    int dir_fd = open(dir_path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC | O_NOFOLLOW);
+    if (dir_fd < 0) {
+        if (cancel.requested()) return false;
         io_errors++;
-        return;
+        return true;
     }
     
-    std::vector<fs::directory_entry> batch;
+    // The recorded names stand in for the listing. Files are stat'ed again,
+    // unless mtimes are trusted, in which case their recorded sizes are
+    // taken as they are; subdirectories always need a fresh stat to check
+    // their own timestamps. Hard-linked files are stat'ed either way, so
+    // their inodes are known when another link turns up in a directory
+    // that is listed again.
+    const size_t worker = WorkStealingThreadPool::current_worker();
+    const bool totals_only = keep_depth >= 0 && state.depth >= static_cast<uint32_t>(keep_depth);
+    uint64_t copied_size = 0;
+    uint64_t copied_entries = 0;
+    bool complete = true;
+    std::vector<DirRecord> batch;
     batch.reserve(BATCH_SIZE);
     
-    for (const auto& item : entries) {
-        batch.push_back(item);
+    previous->for_each_child(state.previous, [&](NodeId id) {
+        if (!complete) return;
+        const Node& old = (*previous)[id];
+        
+        if (config.trust_mtime && !old.is_directory() && !old.is_symlink() &&
+            !(old.flags & (NODE_HARDLINK | NODE_DUPLICATE))) {
+            entries_traversed++;
+            file_count++;
+            copied_size += old.size;
+            copied_entries += old.entry_count;
+            if (!totals_only) {
+                Node& node = store[store.create(worker, state.node, previous->name(id), 0)];
+                node.mtime = old.mtime;
+                node.size = old.size;
+                node.entry_count = old.entry_count;
+            }
+            return;
+        }
         
+        // Arena names are NUL-terminated, so they work as C strings
+        DirEntryType type = old.is_symlink() ? DirEntryType::Symlink : DirEntryType::Unknown;
+        batch.push_back({previous->name(id).data(), 0, type});
         if (batch.size() >= BATCH_SIZE) {
-            scan_directory_batch(entry, batch, root_device);
+            complete = scan_directory_batch(state, batch, dir_fd, root_device, cancel,
+                                            previous_dirs);
             batch.clear();
         }
+    });
+    
+    if (complete && !batch.empty()) {
+        complete = scan_directory_batch(state, batch, dir_fd, root_device, cancel, previous_dirs);
     }
+    close(dir_fd);
     
-    if (!batch.empty()) {
-        scan_directory_batch(entry, batch, root_device);
+    state.size.fetch_add(copied_size, std::memory_order_relaxed);
+    state.entry_count.fetch_add(copied_entries, std::memory_order_relaxed);
+    return complete;
+}
+
+OptimizedScanner::DeviceQueue& OptimizedScanner::device_queue(dev_t device) {
+    // Nearly every directory is on the same device as the one before
+    thread_local uint64_t cached_scanner = 0;
+    thread_local dev_t cached_device = 0;
+    thread_local DeviceQueue* cached_queue = nullptr;
+    if (cached_scanner == instance_id && cached_device == device) {
+        return *cached_queue;
+    }
+    
+    std::lock_guard<std::mutex> lock(device_mutex);
+    DeviceQueue* queue = nullptr;
+    for (const auto& known : device_queues) {
+        if (known->device == device) {
+            queue = known.get();
+            break;
+        }
     }
+    if (!queue) {
+        device_queues.push_back(std::make_unique<DeviceQueue>());
+        queue = device_queues.back().get();
+        queue->device = device;
+        queue->rotational = is_rotational_device(device);
+        queue->limit = queue->rotational ? ROTATIONAL_DIR_LIMIT : 0;
+        for (const auto& [overridden, limit] : device_overrides) {
+            if (overridden == device) {
+                queue->limit = limit;
+            }
+        }
+        // A limit the pool cannot reach anyway only costs locking
+        if (queue->limit >= pool.size()) {
+            queue->limit = 0;
+        }
+    }
+    
+    cached_scanner = instance_id;
+    cached_device = device;
+    cached_queue = queue;
+    return *queue;
 }
 
-uintmax_t OptimizedScanner::calculate_sizes(std::shared_ptr<Entry> entry) {
-    if (!entry->is_directory) {
-        entry->entry_count = entry->size > 0 ? 1 : 0;
-        return entry->size.load();
+bool OptimizedScanner::admit(ScanState* state) {
+    DeviceQueue& queue = device_queue(state->device);
+    if (queue.limit == 0) {
+        return true;
     }
     
-    uintmax_t total = 0;
-    uint64_t count = 0;
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (queue.running < queue.limit) {
+        queue.running++;
+        return true;
+    }
+    queue.waiting.push_back(state);
+    queue.waited++;
+    return false;
+}
+
+void OptimizedScanner::release(dev_t device) {
+    DeviceQueue& queue = device_queue(device);
+    if (queue.limit == 0) {
+        return;
+    }
     
+    // The slot goes straight to a waiting directory, if there is one. It
+    // is queued while this task still runs, so the pool cannot go idle
+    // with directories left waiting.
+    ScanState* next = nullptr;
     {
-        std::lock_guard<std::mutex> lock(entry->children_mutex);
-        for (auto& child : entry->children) {
-            total += calculate_sizes(child);
-            count += child->entry_count.load();
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.waiting.empty()) {
+            queue.running--;
+            return;
         }
-        
-        std::sort(entry->children.begin(), entry->children.end(),
-            [](const std::shared_ptr<Entry>& a, const std::shared_ptr<Entry>& b) {
-                return a->size.load() > b->size.load();
-            });
+        next = queue.waiting.back();
+        queue.waiting.pop_back();
     }
+    next->admitted = true;
+    // Only -x compares against the root device, and then every directory
+    // scanned is on it
+    pool.enqueue([this, next]() {
+        scan_directory_impl(next, next->device);
+    });
+}
+
+void OptimizedScanner::record_work(std::chrono::steady_clock::time_point started,
+                                   size_t handled_before) {
+    if (!pool.is_adaptive()) return;
+    auto elapsed = std::chrono::steady_clock::now() - started;
+    // The directory itself counts, so empty ones still register
+    pool.record_work(entries_handled - handled_before + 1, static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()));
+}
+
+void OptimizedScanner::scan_directory_impl(ScanState* state, dev_t root_device) {
+    if (!state->admitted && !admit(state)) {
+        return;
+    }
+    auto started = std::chrono::steady_clock::now();
+    size_t handled_before = entries_handled;
     
-    entry->size = total;
-    entry->entry_count = count;
-    return total;
+    fs::path dir_path = state->path.empty() ? store.path(state->node) : fs::path(state->path);
+    // Children past the kept depth build their paths from this one
+    if (state->path.empty() && keep_depth >= 0 && 
+        state->depth >= static_cast<uint32_t>(keep_depth)) {
+        state->path = dir_path.string();
+    }
+    
+    {
+        std::lock_guard<std::mutex> lock(current_path_mutex);
+        current_path = dir_path.string();
+    }
+    
+    // Subdirectories are matched to the previous scan by name
+    PreviousDirs previous_dirs;
+    bool reuse = false;
+    if (state->previous != INVALID_NODE) {
+        previous->for_each_child(state->previous, [&](NodeId id) {
+            const Node& old = (*previous)[id];
+            if (old.is_directory() && !old.is_symlink()) {
+                previous_dirs.emplace(previous->name(id), id);
+            }
+        });
+        reuse = directory_unchanged(state->previous, state->stamp);
+        (reuse ? dirs_reused : dirs_rescanned)++;
+    }
+    
+    auto token = watchdog.begin();
+    bool requeued = false;
+    bool complete = reuse 
+        ? reuse_directory(*state, dir_path, root_device, token.cancel, previous_dirs)
+        : list_directory(*state, dir_path, root_device, token.cancel, previous_dirs, requeued);
+    watchdog.end(token);
+    // Whoever frees a slot on its device lists it again from the start
+    if (requeued) {
+        return;
+    }
+    release(state->device);
+    record_work(started, handled_before);
+    
+    // Keep whatever was read before the deadline and flag the directory
+    if (!complete && !state->incomplete.exchange(true, std::memory_order_relaxed)) {
+        skipped_entries++;
+    }
+    
+    finish_directory(state);
 }
 
-std::vector<std::shared_ptr<Entry>> OptimizedScanner::scan(const std::vector<fs::path>& paths) {
-    std::vector<std::shared_ptr<Entry>> roots;
+void OptimizedScanner::finish_directory(ScanState* state) {
+    // Walk up for as long as this thread is the last one out of a directory
+    while (state && state->pending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        uint64_t size = state->size.load(std::memory_order_relaxed);
+        uint64_t entries = state->entry_count.load(std::memory_order_relaxed);
+        bool incomplete = state->incomplete.load(std::memory_order_relaxed);
+        if (state->node != INVALID_NODE) {
+            Node& node = store[state->node];
+            node.size = size;
+            node.entry_count = static_cast<uint32_t>(entries);
+            if (incomplete) {
+                node.flags |= NODE_INCOMPLETE;
+            }
+        }
+        
+        ScanState* parent = state->parent;
+        if (parent) {
+            parent->size.fetch_add(size, std::memory_order_relaxed);
+            parent->entry_count.fetch_add(entries, std::memory_order_relaxed);
+            if (incomplete) {
+                parent->incomplete.store(true, std::memory_order_relaxed);
+            }
+        }
+        delete state;
+        state = parent;
+    }
+}
+
+void OptimizedScanner::set_previous(const NodeStore& prev, const std::vector<NodeId>& roots,
+                                    int64_t started) {
+    previous = &prev;
+    previous_roots = roots;
+    previous_started = started;
+}
+
+void OptimizedScanner::reset_counters() {
+    total_size = 0;
+    file_count = 0;
+    dir_count = 0;
+    symlink_count = 0;
+    io_errors = 0;
+    entries_traversed = 0;
+    skipped_entries = 0;
+    engine_fallbacks = 0;
+    hard_link_duplicates = 0;
+    dirs_reused = 0;
+    dirs_rescanned = 0;
+    dirs_split = 0;
+    workers_at_start = pool.active_count();
+    {
+        std::lock_guard<std::mutex> lock(device_mutex);
+        for (auto& queue : device_queues) {
+            queue->waited = 0;
+        }
+    }
+    spilled_before = pool.spilled_count();
+    ops_limiter.set_rate(config.polite ? static_cast<double>(ops_limit()) : 0.0);
+    ops_before = ops_limiter.operations();
+    if (!keep_inodes) {
+        seen_inodes.clear();
+    }
+    keep_inodes = false;
+    visited_dirs.clear();
+    start_time = std::chrono::steady_clock::now();
+}
+
+std::vector<NodeId> OptimizedScanner::scan(const std::vector<fs::path>& paths, int depth) {
+    std::vector<NodeId> roots;
+    keep_depth = depth;
+    reset_counters();
+    // Moving mount points and previous timestamps both need the stat up
+    // front, so those modes keep it
+    trust_dirent = config.no_entry_check && !config.stay_on_filesystem && !previous;
     
     for (const auto& path : paths) {
-        auto root = std::make_shared<Entry>(path);
-        root->is_directory = fs::is_directory(path);
+        EntryStat st;
+        bool have_stat = stat_entry(path, st);
+        bool is_symlink = have_stat && st.type == DirEntryType::Symlink;
+        bool is_directory = fs::is_directory(path);
+        
+        uint32_t flags = NODE_ROOT;
+        if (is_directory) flags |= NODE_DIRECTORY;
+        if (is_symlink) flags |= NODE_SYMLINK;
+        NodeId root = store.create(SIZE_MAX, INVALID_NODE, path.string(), flags);
+        
+        if (is_symlink) {
+            try {
+                store.set_symlink_target(SIZE_MAX, root, fs::read_symlink(path).string());
+            } catch (...) {
+            }
+        } else {
+            store[root].mtime = st.mtime_sec;
+            if (record_stamps && is_directory) {
+                store.set_stamp(SIZE_MAX, root, stamp_of(st));
+            }
+        }
         
         {
             std::lock_guard<std::mutex> lock(current_path_mutex);
             current_path = path.string();
         }
         
-        if (root->is_directory) {
+        if (is_directory) {
             dir_count++;
             entries_traversed++;
             update_progress();
-            scan_directory_impl(root, root->device_id);
+            if (!is_symlink && should_scan_directory(st)) {
+                auto* state = new ScanState(root, nullptr);
+                state->stamp = stamp_of(st);
+                state->device = st.device;
+                for (NodeId old : previous_roots) {
+                    if (previous->name(old) == path.string()) {
+                        state->previous = old;
+                        break;
+                    }
+                }
+                scan_directory_impl(state, st.device);
+            }
         } else {
-            root->apparent_size = fs::file_size(path);
-            root->size = config.apparent_size ? root->apparent_size.load() : 
-                       get_size_on_disk(path, root->apparent_size);
+            uintmax_t apparent = fs::file_size(path);
+            Node& node = store[root];
+            node.size = config.apparent_size ? apparent : get_size_on_disk(path, apparent);
+            node.entry_count = node.size > 0 ? 1 : 0;
             file_count++;
             entries_traversed++;
             update_progress();
@@ -480,13 +1708,64 @@ std::vector<std::shared_ptr<Entry>> OptimizedScanner::scan(const std::vector<fs:
         progress_throttle.clear_line();
     }
     
-    for (auto& root : roots) {
-        total_size += calculate_sizes(root);
+    // Every root was finalized by the last directory to finish under it
+    for (NodeId root : roots) {
+        total_size += store[root].size;
     }
     
     return roots;
 }
 
+void OptimizedScanner::keep_counted_inodes(const std::vector<fs::path>& counted,
+                                           const std::vector<fs::path>& released) {
+    auto key_of = [](const fs::path& path, ConcurrentInodeSet::Key& key) {
+        EntryStat st;
+        if (!stat_entry(path, st) || st.type != DirEntryType::Regular) return false;
+        key = {static_cast<uint64_t>(st.device), static_cast<uint64_t>(st.inode)};
+        return true;
+    };
+    
+    ConcurrentInodeSet::Key key;
+    for (const auto& path : counted) {
+        if (key_of(path, key)) seen_inodes.insert(key);
+    }
+    for (const auto& path : released) {
+        if (key_of(path, key)) seen_inodes.erase(key);
+    }
+    keep_inodes = true;
+}
+
+void OptimizedScanner::set_ops_limit(size_t per_second) {
+    ops_cap.store(per_second, std::memory_order_relaxed);
+    if (config.polite) {
+        ops_limiter.set_rate(static_cast<double>(per_second));
+    }
+}
+
+void OptimizedScanner::print_concurrency() const {
+    std::cerr << "Workers: adaptive, at most " << pool.size() 
+              << (pool.capped_by_cgroup() ? " (cgroup cpu.max)" : "") << "; " << workers_at_start;
+    
+    // Changes made during this scan, with the throughput that led to them
+    size_t shown = 0;
+    size_t changes = 0;
+    for (const auto& change : pool.concurrency_history()) {
+        if (change.when < start_time) continue;
+        changes++;
+        if (shown == MAX_SHOWN_CHANGES) continue;
+        auto at = std::chrono::duration_cast<std::chrono::milliseconds>(change.when - start_time);
+        std::ostringstream rate;
+        rate << std::fixed << std::setprecision(0) << change.items_per_sec;
+        std::cerr << " -> " << change.workers << " at " << at.count() << "ms (" 
+                  << rate.str() << " entries/s)";
+        shown++;
+    }
+    if (changes > shown) {
+        std::cerr << " ... " << (changes - shown) << " more, ending at " << pool.active_count();
+    }
+    std::cerr << "\n";
+}
+
 void OptimizedScanner::print_stats() {
     auto duration = std::chrono::steady_clock::now() - start_time;
     auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(duration).count();
@@ -497,19 +1776,88 @@ void OptimizedScanner::print_stats() {
     if (io_errors > 0) {
         std::cerr << "Encountered " << io_errors << " I/O errors\n";
     }
+    size_t lock_acquisitions = seen_inodes.lock_acquisitions();
+    if (lock_acquisitions > 0) {
+        std::cerr << "Hard links: " << seen_inodes.size() << " inodes tracked, "
+                  << hard_link_duplicates << " duplicate links skipped, "
+                  << seen_inodes.lock_contentions() << " of " << lock_acquisitions
+                  << " shard locks contended\n";
+    }
+    if (previous) {
+        std::cerr << "Incremental: " << dirs_reused << " directories unchanged, "
+                  << dirs_rescanned << " listed again"
+                  << (config.trust_mtime ? " (trusting recorded file sizes)" : "") << "\n";
+    }
+    {
+        std::lock_guard<std::mutex> lock(device_mutex);
+        for (const auto& queue : device_queues) {
+            if (queue->limit == 0) continue;
+            std::cerr << "Device " << major(queue->device) << ":" << minor(queue->device)
+                      << (queue->rotational ? " (rotational)" : "") << ": " << queue->limit
+                      << " directories at once, " << queue->waited << " waited for a turn\n";
+        }
+    }
+    if (pool.is_adaptive()) {
+        print_concurrency();
+    }
+    if (config.polite) {
+        uint64_t operations = ops_limiter.operations() - ops_before;
+        double seconds = std::chrono::duration<double>(duration).count();
+        std::cerr << "Polite: " << operations << " metadata operations at "
+                  << static_cast<size_t>(seconds > 0 ? operations / seconds : 0.0) 
+                  << "/s (cap " << ops_limit() << "/s), ";
+        if (int error = pool.idle_failure()) {
+            std::cerr << "could not lower worker priority: " << std::strerror(error) << "\n";
+        } else if (pool.is_idle()) {
+            std::cerr << "workers at idle I/O and CPU priority\n";
+        } else {
+            std::cerr << "workers at normal priority\n";
+        }
+    }
+    if (dirs_split > 0) {
+        std::cerr << "Split " << dirs_split << " large directories into parallel stat chunks\n";
+    }
+    size_t spilled = pool.spilled_count() - spilled_before;
+    if (spilled > 0) {
+        std::cerr << "Scheduler: " << spilled << " directories set aside while worker "
+                  << "queues were full\n";
+    }
     if (skipped_entries > 0) {
-        std::cerr << "Skipped " << skipped_entries << " unresponsive directories\n";
+        std::cerr << "Abandoned " << skipped_entries << " unresponsive directories after "
+                  << config.fs_timeout.count() << "ms, their totals are incomplete\n";
+    }
+    if (use_io_uring) {
+        std::cerr << "Stat engine: io_uring";
+        if (engine_fallbacks > 0) {
+            std::cerr << " (" << engine_fallbacks << " batches fell back to sync)";
+        }
+        std::cerr << "\n";
+    } else if (!engine_note.empty()) {
+        std::cerr << "Stat engine: sync, " << engine_note << "\n";
+    } else {
+        std::cerr << "Stat engine: sync\n";
+    }
+    
+    // Totals-only scans give the roots nodes and nothing else
+    size_t nodes = store.node_count();
+    if (nodes > 0 && keep_depth != 0) {
+        size_t bytes = store.node_bytes() + store.string_bytes();
+        std::ostringstream per_entry;
+        per_entry << std::fixed << std::setprecision(1) << static_cast<double>(bytes) / nodes
+                  << " bytes/entry, " << sizeof(Node) << " per node plus names, "
+                  << (100 * store.shared_name_count() / nodes) << "% of names shared";
+        std::cerr << "Tree memory: " << format_size(bytes, config.format) << " for "
+                  << nodes << " entries (" << per_entry.str() << ")\n";
     }
     std::cerr << "Total size: " << format_size(total_size, config.format) << "\n";
 }
 
 // Tree printing function
-void print_tree_sorted(const std::shared_ptr<Entry>& entry, const Config& config,
-                      const std::string& prefix, bool is_last, 
-                      int depth, std::vector<std::shared_ptr<Entry>>* siblings) {
-    (void)siblings;  // Suppress unused parameter warning
+void print_tree_sorted(const NodeStore& store, NodeId id, const Config& config,
+                      const std::string& prefix, bool is_last, int depth) {
     if (config.max_depth >= 0 && depth > config.max_depth) return;
     
+    const Node& node = store[id];
     std::cout << prefix;
     
     if (depth > 0) {
@@ -517,25 +1865,20 @@ void print_tree_sorted(const std::shared_ptr<Entry>& entry, const Config& config
     }
     
     if (!config.no_colors) {
-        if (entry->is_symlink) {
+        if (node.is_symlink()) {
             std::cout << MAGENTA;
-        } else if (entry->is_directory) {
+        } else if (node.is_directory()) {
             std::cout << BLUE << BOLD;
         }
     }
     
-    std::string name = entry->path.filename().string();
-    if (name.empty() && depth == 0) {
-        name = entry->path.string();
-    }
-    
-    std::cout << name;
+    std::cout << store.display_name(id);
     
-    if (entry->is_symlink) {
-        std::cout << " -> " << entry->symlink_target.string();
+    if (node.is_symlink()) {
+        std::cout << " -> " << store.symlink_target(id);
     }
     
-    if (!config.no_colors && (entry->is_symlink || entry->is_directory)) {
+    if (!config.no_colors && (node.is_symlink() || node.is_directory())) {
         std::cout << RESET;
     }
     
@@ -545,46 +1888,48 @@ void print_tree_sorted(const std::shared_ptr<Entry>& entry, const Config& config
         std::cout << YELLOW;
     }
     
-    std::cout << "[" << format_size(entry->size, config.format) << "]";
+    std::cout << "[" << format_size(node.size, config.format) << "]";
     
     if (!config.no_colors) {
         std::cout << RESET;
     }
     
+    if (node.is_incomplete()) {
+        std::cout << " " << (config.no_colors ? "" : RED) << "(incomplete)"
+                  << (config.no_colors ? "" : RESET);
+    }
+    
     std::cout << "\n";
     
-    if (entry->is_directory && !entry->is_symlink) {
-        std::vector<std::shared_ptr<Entry>> children_copy;
-        {
-            std::lock_guard<std::mutex> lock(entry->children_mutex);
-            children_copy = entry->children;
-        }
+    // Nothing below the depth limit is printed (or, from a depth-bounded
+    // scan, even there)
+    if (node.is_directory() && !node.is_symlink() &&
+        (config.max_depth < 0 || depth < config.max_depth)) {
+        std::vector<NodeId> children = store.children(id);
         
-        std::sort(children_copy.begin(), children_copy.end(),
-            [](const std::shared_ptr<Entry>& a, const std::shared_ptr<Entry>& b) {
-                return a->size.load() > b->size.load();
-            });
-        
-        size_t limit = children_copy.size();
+        size_t limit = children.size();
         if (config.top_n > 0 && limit > static_cast<size_t>(config.top_n)) {
             limit = static_cast<size_t>(config.top_n);
         }
         
+        // With --top only the largest few need ordering
+        order_children(store, children, SortMode::SIZE_DESC, limit);
+        
         for (size_t i = 0; i < limit; i++) {
             bool child_is_last = (i == limit - 1);
             std::string child_prefix = prefix + (is_last ? "    " : "│   ");
             
-            print_tree_sorted(children_copy[i], config, child_prefix, child_is_last, 
-                             depth + 1, &children_copy);
+            print_tree_sorted(store, children[i], config, child_prefix, child_is_last, 
+                             depth + 1);
         }
         
-        if (config.top_n > 0 && children_copy.size() > static_cast<size_t>(config.top_n)) {
+        if (config.top_n > 0 && children.size() > static_cast<size_t>(config.top_n)) {
             std::string omit_prefix = prefix + (is_last ? "    " : "│   ");
             std::cout << omit_prefix << "└── ";
             if (!config.no_colors) {
                 std::cout << GRAY;
             }
-            std::cout << "... " << (children_copy.size() - limit) << " more entries";
+            std::cout << "... " << (children.size() - limit) << " more entries";
             if (!config.no_colors) {
                 std::cout << RESET;
             }
@@ -592,3 +1937,41 @@ void print_tree_sorted(const std::shared_ptr<Entry>& entry, const Config& config
         }
     }
 }
+
+// Rebuild the full path of every node, as the UI does on demand, and
+// report what it costs per path and per screenful of rows
+void benchmark_path_reconstruction(const NodeStore& store, const std::vector<NodeId>& roots) {
+    std::vector<NodeId> nodes;
+    std::vector<NodeId> stack = roots;
+    while (!stack.empty()) {
+        NodeId id = stack.back();
+        stack.pop_back();
+        nodes.push_back(id);
+        if (!store[id].is_symlink()) {
+            store.for_each_child(id, [&](NodeId child) {
+                stack.push_back(child);
+            });
+        }
+    }
+    if (nodes.empty()) return;
+    
+    size_t total_length = 0;
+    size_t deepest = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (NodeId id : nodes) {
+        std::string path = store.path(id).native();
+        total_length += path.size();
+        deepest = std::max<size_t>(deepest, std::count(path.begin(), path.end(), '/'));
+    }
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    double ns = std::chrono::duration<double, std::nano>(elapsed).count() / nodes.size();
+    
+    std::ostringstream oss;
+    oss << std::fixed << std::setprecision(1)
+        << "Rebuilt " << nodes.size() << " paths in "
+        << std::chrono::duration<double, std::milli>(elapsed).count() << "ms: "
+        << ns << " ns/path, average length " << total_length / nodes.size()
+        << ", deepest " << deepest << " levels, a 100-row screen costs "
+        << ns * 100 / 1000.0 << " us\n";
+    std::cerr << oss.str();
+}
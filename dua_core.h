@@ -18,7 +18,6 @@
 #include <unordered_set>
 #include <sstream>
 #include <memory>
-#include <future>
 #include <numeric>
 #include <regex>
 #include <cstdlib>
@@ -26,6 +25,12 @@
 #include <set>
 #include <unistd.h>
 #include <deque>
+#include <new>
+#include <type_traits>
+#include "dua_fs.h"
+#include "dua_tree.h"
+
+#include <pthread.h>
 
 #ifdef __linux__
 #include <sys/stat.h>
@@ -47,8 +52,12 @@ namespace fs = std::filesystem;
 constexpr size_t THREAD_POOL_SIZE = 0;  // 0 = auto-detect
 constexpr size_t BATCH_SIZE = 256;      // Files to process per batch
 constexpr size_t QUEUE_SIZE_LIMIT = 50000;
-constexpr size_t PREALLOCATE_ENTRIES = 100;
+constexpr size_t SPLIT_DIR_ENTRIES = 8192;  // Larger directories are stat'ed in parallel chunks
+constexpr size_t STAT_CHUNK_ENTRIES = 2048; // Smallest chunk worth a task of its own
+constexpr size_t ROTATIONAL_DIR_LIMIT = 2;  // Directories listed at once per spinning disk
 constexpr auto FS_TIMEOUT = std::chrono::seconds(5);
+constexpr size_t POLITE_OPS = 500;          // Metadata operations per second under --polite
+constexpr size_t MIN_POLITE_OPS = 10;
 
 // ANSI color codes
 extern const std::string RESET;
@@ -75,32 +84,26 @@ struct Config {
     bool no_colors = false;
     bool tree_mode = false;
     bool show_progress = true;
+    bool bench_paths = false;
     int max_depth = -1;
     int top_n = -1;
     size_t thread_count = 0;
+    std::chrono::milliseconds fs_timeout = FS_TIMEOUT;
     std::string format = "metric";
+    std::string stat_engine = "sync";
     std::set<fs::path> ignore_dirs;
+    // Directories listed at once on the device behind each path, 0 for no limit
+    std::vector<std::pair<fs::path, size_t>> device_limits;
     std::vector<fs::path> paths;
-};
-
-// Entry structure
-struct Entry {
-    fs::path path;
-    std::atomic<uintmax_t> size{0};
-    std::atomic<uintmax_t> apparent_size{0};
-    bool is_directory{false};
-    bool is_symlink{false};
-    fs::path symlink_target;
-    std::vector<std::shared_ptr<Entry>> children;
-    mutable std::mutex children_mutex;
-    fs::file_time_type last_modified;
-    std::atomic<bool> marked{false};
-    std::atomic<uint64_t> entry_count{0};
-    dev_t device_id{0};
-    ino_t inode{0};
-    nlink_t hard_link_count{1};
-    
-    Entry(const fs::path& p = "");
+    fs::path save_snapshot_path;
+    fs::path load_snapshot_path;
+    fs::path incremental_path;
+    bool trust_mtime = false;
+    bool watch = false;
+    // Idle I/O and CPU priority for the workers, and at most polite_ops
+    // metadata operations per second while scanning
+    bool polite = false;
+    size_t polite_ops = POLITE_OPS;
 };
 
 // Progress throttle class
@@ -117,42 +120,257 @@ public:
     void clear_line() const;
 };
 
-// Work-stealing thread pool
-class WorkStealingThreadPool {
+// Fixed-size task. Small trivially copyable callables (the scanner's
+// lambdas) are stored inline; anything else is boxed on the heap.
+class Task {
+public:
+    static constexpr size_t WORDS = 4;  // Invoke pointer plus 24 bytes of payload
+    using Invoke = void (*)(const uint64_t* payload);
+    
+    uint64_t words[WORDS] = {};
+    
+    template<class F>
+    static Task make(F&& f);
+    
+    void operator()() const {
+        reinterpret_cast<Invoke>(static_cast<uintptr_t>(words[0]))(words + 1);
+    }
+};
+
+// Chase-Lev work-stealing deque of bounded capacity. The owner pushes and
+// pops at the bottom, thieves take from the top; slots are atomic words so
+// a racing steal never reads a torn task.
+class WorkDeque {
 private:
-    struct WorkQueue {
-        std::deque<std::function<void()>> tasks;
-        std::mutex mutex;
-        std::atomic<size_t> size{0};
+    struct Slot {
+        std::atomic<uint64_t> words[Task::WORDS];
     };
     
+    alignas(64) std::atomic<int64_t> top{0};
+    alignas(64) std::atomic<int64_t> bottom{0};
+    alignas(64) std::unique_ptr<Slot[]> slots;
+    int64_t capacity;
+    
+    void load(int64_t index, Task& task) const;
+    
+public:
+    explicit WorkDeque(size_t min_capacity);
+    
+    // Owner only; false when full
+    bool push(const Task& task);
+    // Owner only; most recently pushed task first
+    bool pop(Task& task);
+    // Any thread; oldest task first
+    bool steal(Task& task);
+    size_t size_hint() const;
+};
+
+// Work-stealing thread pool
+class WorkStealingThreadPool {
+private:
     std::vector<std::thread> workers;
-    std::vector<std::unique_ptr<WorkQueue>> queues;
-    std::condition_variable work_available;
-    std::mutex global_mutex;
+    std::vector<std::unique_ptr<WorkDeque>> queues;
+    // Subtasks that found their worker's deque full. Only the owner
+    // touches its list; it works through them depth first and moves them
+    // back into the deque in batches, where thieves can see them again.
+    struct alignas(64) SpillList {
+        std::vector<Task> tasks;
+    };
+    std::unique_ptr<SpillList[]> spills;
+    size_t refill_batch = 1;
+    std::atomic<size_t> spilled_total{0};
+    std::deque<Task> injected;      // Tasks submitted from outside the pool
+    std::mutex injected_mutex;
+    std::atomic<size_t> injected_size{0};
     std::atomic<bool> stop{false};
-    std::atomic<size_t> active_workers{0};
-    std::atomic<size_t> total_tasks{0};
     size_t num_threads;
+    bool idle_priority = false;
+    std::atomic<int> idle_error{0};     // Why a worker kept its priority
     
-    bool try_steal(size_t thief_id, std::function<void()>& task);
+    // Termination latch: counts tasks submitted but not yet finished. A
+    // task's subtasks are counted before it finishes, so zero means done.
+    alignas(64) std::atomic<size_t> pending_tasks{0};
+    std::mutex done_mutex;
+    std::condition_variable done_cv;
+    
+    // Idle workers park until a submit bumps the wake epoch
+    alignas(64) std::atomic<size_t> sleeping_workers{0};
+    std::atomic<uint64_t> wake_epoch{0};
+    std::mutex park_mutex;
+    std::condition_variable park_cv;
+    
+    // Adaptive concurrency: workers from active_workers up sit out (on
+    // active_cv, under park_mutex) while a controller thread moves the
+    // limit towards the knee of the measured throughput curve
+    struct alignas(64) WorkMeter {
+        std::atomic<uint64_t> items{0};
+        std::atomic<uint64_t> latency_ns{0};
+        std::atomic<uint64_t> units{0};
+    };
+    bool adaptive = false;
+    bool cgroup_capped = false;
+    alignas(64) std::atomic<size_t> active_workers{0};
+    std::condition_variable active_cv;
+    std::unique_ptr<WorkMeter[]> meters;    // One per worker plus one for other threads
+    std::thread controller;
+    std::mutex controller_mutex;
+    std::condition_variable controller_cv;
+    
+public:
+    struct ConcurrencyChange {
+        std::chrono::steady_clock::time_point when;
+        size_t workers;
+        double items_per_sec;       // Measured just before the change
+        double latency_ms;          // Mean per unit of work, likewise
+    };
+    static constexpr auto CONTROL_INTERVAL = std::chrono::milliseconds(200);
+    static constexpr double KNEE_GAIN = 0.05;   // Smaller changes count as flat
+    static constexpr int HOLD_INTERVALS = 10;   // Rest after settling, then probe again
+    static constexpr size_t MAX_HISTORY = 256;
+    
+private:
+    std::vector<ConcurrencyChange> history;
+    mutable std::mutex history_mutex;
+    
+    static thread_local size_t worker_index;
+    static thread_local const WorkStealingThreadPool* worker_pool;
+    
+    void submit(const Task& task);
+    void wake_one();
+    void finish_task();
+    bool has_visible_work() const;
+    bool take_spilled(size_t id, Task& task);
+    bool take_injected(Task& task);
+    bool try_steal(size_t thief_id, Task& task);
+    void park();
     void worker_thread(size_t id);
+    void control_loop();
+    void set_active(size_t count, double items_per_sec, double latency_ms);
     
 public:
-    explicit WorkStealingThreadPool(size_t threads = 0);
+    // A fixed number of workers, or with 0 as many as the CPUs the process
+    // may use (cgroup cpu.max included), of which the controller keeps
+    // only as many active as still add throughput. With idle, every worker
+    // drops to idle I/O and CPU priority as it starts.
+    explicit WorkStealingThreadPool(size_t threads = 0, bool idle = false);
     ~WorkStealingThreadPool();
     
+    size_t size() const { return num_threads; }
+    // Index of the calling worker thread, or SIZE_MAX outside the pool
+    static size_t current_worker() { return worker_index; }
+    // Subtasks put aside because their worker's deque was full, ever
+    size_t spilled_count() const { return spilled_total.load(std::memory_order_relaxed); }
+    bool is_idle() const { return idle_priority; }
+    // errno of a worker that could not lower its priority, 0 if all did
+    int idle_failure() const { return idle_error.load(std::memory_order_relaxed); }
+    
+    bool is_adaptive() const { return adaptive; }
+    // Whether size() was lowered to the cgroup's CPU quota
+    bool capped_by_cgroup() const { return cgroup_capped; }
+    size_t active_count() const { return active_workers.load(std::memory_order_relaxed); }
+    // Report one unit of work (a directory) that handled items entries in
+    // latency_ns; this is what the controller measures
+    void record_work(size_t items, uint64_t latency_ns);
+    std::vector<ConcurrencyChange> concurrency_history() const;
+    
     template<class F>
     void enqueue(F&& f);
     
+    // Block until every submitted task (and everything it spawned) is done
     void wait_all();
 };
 
+// Watchdog for hung directory reads. Workers register each directory they
+// work on in their own slot; a single background thread flags the ones past
+// the deadline and interrupts the blocked syscall so the read can be
+// abandoned as partial.
+class ScanWatchdog {
+private:
+    struct alignas(64) Slot {
+        std::atomic<uint64_t> active{0};      // Generation in flight, 0 = idle
+        std::atomic<uint64_t> abandoned{0};   // Generation to abandon
+        std::atomic<int64_t> started_ns{0};
+        pthread_t thread{};
+    };
+    
+    std::unique_ptr<Slot[]> slots;
+    size_t slot_count;
+    std::chrono::milliseconds deadline;
+    std::atomic<uint64_t> next_generation{1};
+    std::atomic<size_t> timeouts{0};
+    std::thread monitor;
+    std::mutex monitor_mutex;
+    std::condition_variable monitor_cv;
+    bool stop = false;
+    
+    void monitor_loop();
+    
+public:
+    struct Token {
+        size_t slot;
+        ReadCancel cancel;
+    };
+    
+    ScanWatchdog(size_t workers, std::chrono::milliseconds timeout);
+    ~ScanWatchdog();
+    
+    Token begin();
+    void end(const Token& token);
+    size_t timeout_count() const { return timeouts.load(); }
+};
+
+// Concurrent set of (device, inode) keys. Keys are spread over
+// cache-line aligned shards by a strong hash; each shard is an
+// open-addressing table under its own lock.
+class ConcurrentInodeSet {
+public:
+    struct Key {
+        uint64_t device;
+        uint64_t inode;
+    };
+    
+private:
+    struct alignas(64) Shard {
+        std::mutex mutex;
+        std::vector<Key> slots;
+        size_t count = 0;
+        size_t acquisitions = 0;
+        size_t contended = 0;
+    };
+    
+    std::unique_ptr<Shard[]> shards;
+    size_t shard_count;
+    unsigned shard_shift;
+    
+    static uint64_t hash(const Key& key);
+    static bool insert_locked(Shard& shard, const Key& key, uint64_t h);
+    static void grow(Shard& shard, size_t min_count);
+    void lock(Shard& shard, std::unique_lock<std::mutex>& guard);
+    
+public:
+    explicit ConcurrentInodeSet(size_t threads);
+    
+    // True if key was not in the set yet
+    bool insert(const Key& key);
+    // Insert keys[i] for each i, setting inserted[i]; every shard is
+    // locked at most once and sized for its share of the batch up front
+    void insert_batch(const std::vector<Key>& keys, std::vector<char>& inserted);
+    // True if key was in the set
+    bool erase(const Key& key);
+    
+    size_t size() const;
+    // Empty the set and give its memory back
+    void clear();
+    size_t lock_acquisitions() const;
+    size_t lock_contentions() const;
+};
+
 // Optimized scanner
 class OptimizedScanner {
 private:
     WorkStealingThreadPool& pool;
     Config& config;
+    NodeStore& store;
     std::atomic<uintmax_t> total_size{0};
     std::atomic<size_t> file_count{0};
     std::atomic<size_t> dir_count{0};
@@ -160,79 +378,225 @@ private:
     std::atomic<size_t> io_errors{0};
     std::atomic<size_t> entries_traversed{0};
     std::atomic<size_t> skipped_entries{0};
+    std::atomic<size_t> engine_fallbacks{0};
+    size_t spilled_before = 0;  // Pool's spill count when this scan started
+    size_t workers_at_start = 0;
+    static constexpr size_t MAX_SHOWN_CHANGES = 12;
+    bool use_io_uring = false;
+    std::string engine_note;
     std::chrono::steady_clock::time_point start_time;
     ProgressThrottle progress_throttle;
+    ScanWatchdog watchdog;
     std::string current_path;
     mutable std::mutex current_path_mutex;
     
-    struct InodeKey {
-        dev_t device;
-        ino_t inode;
-        bool operator==(const InodeKey& other) const;
+    ConcurrentInodeSet seen_inodes;
+    std::atomic<size_t> hard_link_duplicates{0};
+    ConcurrentInodeSet visited_dirs;
+    bool keep_inodes = false;   // Next scan starts from seen_inodes as it is
+    std::vector<ConcurrentInodeSet::Key> ignored_dirs;  // Resolved once from config
+    int keep_depth = -1;        // Deepest level that gets nodes, -1 for all
+    // --no-entry-check: directory records are taken at their word and only
+    // the directory's own open fd is stat'ed, once it is listed
+    bool trust_dirent = false;
+    // --polite: every stat, open and directory read takes a token first
+    RateLimiter ops_limiter;
+    std::atomic<size_t> ops_cap;    // Starts from config, then set_ops_limit() moves it
+    uint64_t ops_before = 0;        // Limiter's count when this scan started
+    
+    // Previous scan for incremental rescans: directories whose timestamps
+    // match it are not listed again
+    using PreviousDirs = std::unordered_map<std::string_view, NodeId>;
+    const NodeStore* previous = nullptr;
+    std::vector<NodeId> previous_roots;
+    int64_t previous_started = 0;
+    bool record_stamps = false;
+    std::atomic<size_t> dirs_reused{0};
+    std::atomic<size_t> dirs_rescanned{0};
+    
+    // Running totals of a directory still being scanned. pending counts its
+    // own listing plus each child directory not finished yet; whoever drops
+    // it to zero publishes the totals to the node and folds them into the
+    // parent, so sizes ripple up as the scan goes with no post-pass.
+    struct ScanState {
+        NodeId node;            // INVALID_NODE below the materialized depth
+        ScanState* parent;
+        uint32_t depth;
+        NodeId previous = INVALID_NODE;     // Same directory in the previous scan
+        DirStamp stamp{};
+        std::string path;       // Only set when its children get no nodes
+        std::atomic<uint64_t> size{0};
+        std::atomic<uint64_t> entry_count{0};
+        std::atomic<uint32_t> pending{1};
+        std::atomic<bool> incomplete{false};
+        bool unverified = false;    // Not stat'ed yet, see trust_dirent
+        bool admitted = false;      // Handed a device slot while it waited
+        dev_t device = 0;           // The parent's, if unverified
+        
+        ScanState(NodeId id, ScanState* up) 
+            : node(id), parent(up), depth(up ? up->depth + 1 : 0) {}
+    };
+    
+    // A listing shared by the chunks of a split directory. Each chunk
+    // counts as one pending child of the directory; the last one out
+    // frees the listing and closes its fd.
+    struct SplitListing {
+        ScanState* state;
+        std::unique_ptr<DirListing> listing;
+        PreviousDirs previous_dirs;
+        dev_t root_device;
+        std::atomic<size_t> remaining{0};
     };
+    std::atomic<size_t> dirs_split{0};
+    std::mutex splice_mutex;    // Chunks link their children in one at a time
     
-    struct InodeKeyHash {
-        std::size_t operator()(const InodeKey& k) const;
+    // How many directories of one device are listed at once. Spinning
+    // disks are bound by seeks rather than CPUs and get ROTATIONAL_DIR_LIMIT,
+    // other devices no limit unless --device-limit sets one. A directory
+    // over the limit waits in its device's queue without holding a worker.
+    struct DeviceQueue {
+        dev_t device;
+        size_t limit = 0;       // 0 = no limit
+        bool rotational = false;
+        std::mutex mutex;
+        size_t running = 0;
+        std::vector<ScanState*> waiting;    // Most recent first, depth first
+        size_t waited = 0;      // This scan
     };
+    std::vector<std::unique_ptr<DeviceQueue>> device_queues;
+    std::mutex device_mutex;    // Guards adding to device_queues
+    std::vector<std::pair<dev_t, size_t>> device_overrides;    // Resolved once from config
+    const uint64_t instance_id;
     
-    std::unordered_map<InodeKey, size_t, InodeKeyHash> inode_map;
-    std::mutex inode_mutex;
-    std::unordered_set<std::string> visited_dirs;
-    std::mutex visited_mutex;
-    
-    bool should_count_entry(const Entry& entry);
-    bool should_ignore_directory(const fs::path& path);
-    void update_progress() const;
-    bool try_iterate_directory(const fs::path& dir_path, 
-                              std::vector<fs::directory_entry>& entries);
-    void scan_directory_batch(std::shared_ptr<Entry> parent, 
-                            const std::vector<fs::directory_entry>& batch,
-                            dev_t root_device);
-    void scan_directory_impl(std::shared_ptr<Entry> entry, dev_t root_device);
-    uintmax_t calculate_sizes(std::shared_ptr<Entry> entry);
+    DeviceQueue& device_queue(dev_t device);
+    // False if the directory was queued; it is resumed when a slot frees up
+    bool admit(ScanState* state);
+    void release(dev_t device);
+    
+    // Records whose type alone is enough to build their node
+    bool skips_stat(const DirRecord& record) const {
+        return record.type == DirEntryType::Symlink || 
+               (trust_dirent && record.type == DirEntryType::Directory);
+    }
+    void mark_counted(const std::vector<EntryStat>& stats, const std::vector<char>& ok,
+                      std::vector<char>& counted);
+    // False for ignored directories and ones already visited through
+    // another path (bind mounts, repeated roots)
+    bool should_scan_directory(const EntryStat& st);
+    void update_progress();
+    bool try_iterate_directory(const fs::path& dir_path, DirListing& listing,
+                              const ReadCancel& cancel);
+    void stat_batch(int dir_fd, const std::vector<DirRecord>& batch,
+                   std::vector<EntryStat>& stats, std::vector<char>& ok,
+                   const ReadCancel& cancel);
+    bool stat_batch_io_uring(int dir_fd, const std::vector<DirRecord>& batch,
+                            std::vector<EntryStat>& stats, std::vector<char>& ok,
+                            const ReadCancel& cancel);
+    bool scan_directory_batch(ScanState& state, 
+                            const std::vector<DirRecord>& batch,
+                            int dir_fd, dev_t root_device,
+                            const ReadCancel& cancel,
+                            const PreviousDirs& previous_dirs,
+                            NodeStore::ChildChain* chain = nullptr);
+    bool scan_records(ScanState& state, const DirListing& listing, size_t first, size_t last,
+                      dev_t root_device, const ReadCancel& cancel,
+                      const PreviousDirs& previous_dirs, NodeStore::ChildChain* chain);
+    // Sets requeued if the directory turned out to be on another device
+    // and now waits in that device's queue; the caller must leave it be
+    bool list_directory(ScanState& state, const fs::path& dir_path, dev_t root_device,
+                        const ReadCancel& cancel, const PreviousDirs& previous_dirs,
+                        bool& requeued);
+    // How many chunks a listing is worth splitting into, 1 to keep it whole
+    size_t stat_chunks(const ScanState& state, const DirListing& listing);
+    void split_directory(ScanState& state, std::unique_ptr<DirListing> listing, size_t chunks,
+                         dev_t root_device, const PreviousDirs& previous_dirs);
+    void scan_chunk(SplitListing* split, size_t first, size_t last);
+    bool directory_unchanged(NodeId previous_dir, const DirStamp& now) const;
+    bool reuse_directory(ScanState& state, const fs::path& dir_path, dev_t root_device,
+                         const ReadCancel& cancel, const PreviousDirs& previous_dirs);
+    void record_work(std::chrono::steady_clock::time_point started, size_t handled_before);
+    void scan_directory_impl(ScanState* state, dev_t root_device);
+    void finish_directory(ScanState* state);
+    void reset_counters();
+    void print_concurrency() const;
     
 public:
-    OptimizedScanner(WorkStealingThreadPool& tp, Config& cfg);
-    std::vector<std::shared_ptr<Entry>> scan(const std::vector<fs::path>& paths);
+    OptimizedScanner(WorkStealingThreadPool& tp, Config& cfg, NodeStore& nodes);
+    // Reuse what prev recorded for directories that have not changed since
+    // started (seconds since the epoch); prev must outlive scan()
+    void set_previous(const NodeStore& prev, const std::vector<NodeId>& roots, int64_t started);
+    // Scan paths and return one root node per path. Only entries down to
+    // keep_depth (roots are 0) get nodes; everything deeper is folded into
+    // the totals of the deepest kept directory, so memory follows the
+    // number of kept entries rather than the number of files. Counters and
+    // visited inodes start over with each call, so one scanner can serve
+    // any number of scans.
+    std::vector<NodeId> scan(const std::vector<fs::path>& paths, int keep_depth = -1);
+    // Have the next scan keep the inodes counted so far, so a subtree
+    // rescanned on its own still takes hard links counted elsewhere as
+    // duplicates. counted adds files counted outside it; released drops
+    // those counted in the subtree being replaced.
+    void keep_counted_inodes(const std::vector<fs::path>& counted,
+                             const std::vector<fs::path>& released);
     void print_stats();
+    
+    // Entries counted by the scan in progress, for callers showing progress
+    size_t entries_so_far() const { return entries_traversed.load(std::memory_order_relaxed); }
+    // The --polite cap; setting it takes effect at once, also from another
+    // thread while a scan runs, and carries over to later scans
+    size_t ops_limit() const { return ops_cap.load(std::memory_order_relaxed); }
+    void set_ops_limit(size_t per_second);
+    double ops_rate() { return ops_limiter.measured(); }
 };
 
 // Utility functions
 std::string format_size(uintmax_t bytes, const std::string& format);
 uintmax_t get_size_on_disk(const fs::path& path, uintmax_t file_size);
+uintmax_t get_size_on_disk(const EntryStat& st);
 bool glob_match(const std::string& pattern, const std::string& text);
+// The --polite cap one step up or down from current
+size_t step_ops_limit(size_t current, bool raise);
 std::string shorten_path(const std::string& path, size_t max_length = 45);
-void print_tree_sorted(const std::shared_ptr<Entry>& entry, const Config& config,
+void print_tree_sorted(const NodeStore& store, NodeId id, const Config& config,
                       const std::string& prefix = "", bool is_last = true, 
-                      int depth = 0, std::vector<std::shared_ptr<Entry>>* siblings = nullptr);
+                      int depth = 0);
+void benchmark_path_reconstruction(const NodeStore& store, const std::vector<NodeId>& roots);
 
-// Template implementation for WorkStealingThreadPool
+// Template implementation for Task
 template<class F>
-void WorkStealingThreadPool::enqueue(F&& f) {
-    if (stop) return;
-    
-    static std::atomic<size_t> next_queue{0};
-    const size_t actual_threads = queues.size();
-    size_t queue_id = next_queue.fetch_add(1) % actual_threads;
+Task Task::make(F&& f) {
+    using Fn = std::decay_t<F>;
+    Task task;
+    Invoke invoke;
     
-    size_t attempts = 0;
-    while (attempts < actual_threads) {
-        auto& queue = queues[queue_id];
-        
-        if (queue->size.load() < QUEUE_SIZE_LIMIT / actual_threads) {
-            std::lock_guard<std::mutex> lock(queue->mutex);
-            queue->tasks.emplace_back(std::forward<F>(f));
-            queue->size++;
-            total_tasks++;
-            work_available.notify_one();
-            return;
-        }
-        
-        queue_id = (queue_id + 1) % actual_threads;
-        attempts++;
+    if constexpr (std::is_trivially_copyable_v<Fn> && 
+                  sizeof(Fn) <= sizeof(uint64_t) * (WORDS - 1) &&
+                  alignof(Fn) <= alignof(uint64_t)) {
+        std::memcpy(task.words + 1, &f, sizeof(Fn));
+        invoke = [](const uint64_t* payload) {
+            alignas(Fn) unsigned char buffer[sizeof(Fn)];
+            std::memcpy(buffer, payload, sizeof(Fn));
+            (*std::launder(reinterpret_cast<Fn*>(buffer)))();
+        };
+    } else {
+        // Boxed tasks still queued when the pool shuts down are leaked
+        Fn* boxed = new Fn(std::forward<F>(f));
+        task.words[1] = static_cast<uint64_t>(reinterpret_cast<uintptr_t>(boxed));
+        invoke = [](const uint64_t* payload) {
+            std::unique_ptr<Fn> fn(reinterpret_cast<Fn*>(static_cast<uintptr_t>(payload[0])));
+            (*fn)();
+        };
     }
     
-    f();
+    task.words[0] = static_cast<uint64_t>(reinterpret_cast<uintptr_t>(invoke));
+    return task;
+}
+
+// Template implementation for WorkStealingThreadPool
+template<class F>
+void WorkStealingThreadPool::enqueue(F&& f) {
+    if (stop) return;
+    submit(Task::make(std::forward<F>(f)));
 }
 
 #endif // DUA_CORE_H
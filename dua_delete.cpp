@@ -0,0 +1,227 @@
+// dua_delete.cpp - Removing marked entries on the worker pool
+#include "dua_delete.h"
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+
+// DeletionEngine implementation
+DeletionEngine::DeletionEngine(WorkStealingThreadPool& workers, const Config& cfg)
+    : pool(workers), config(cfg) {}
+
+DeletionEngine::~DeletionEngine() {
+    wait();
+}
+
+void DeletionEngine::wait() {
+    if (busy()) {
+        pool.wait_all();
+    }
+}
+
+void DeletionEngine::remove(NodeId node, const fs::path& path) {
+    fs::path entry = path;
+    if (entry.filename().empty()) {
+        entry = entry.parent_path();    // Trailing slash
+    }
+    fs::path parent = entry.parent_path();
+    if (parent.empty()) {
+        parent = ".";
+    }
+
+    targets.push_back(std::make_unique<Target>());
+    Target* target = targets.back().get();
+    target->node = node;
+    target->path = entry.string();
+    target->name = entry.filename().string();
+    running.fetch_add(1, std::memory_order_relaxed);
+
+    target->parent_fd = open(parent.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    struct stat st;
+    if (target->parent_fd < 0 ||
+        fstatat(target->parent_fd, target->name.c_str(), &st, AT_SYMLINK_NOFOLLOW) != 0) {
+        fail(*target, target->path, errno);
+        finish_target(*target);
+        return;
+    }
+
+    if (S_ISDIR(st.st_mode)) {
+        Job* job = new Job();
+        job->target = target;
+        job->parent = nullptr;
+        job->path = target->path;
+        job->name = target->name;
+        pool.enqueue([this, job]() {
+            remove_directory(job);
+        });
+    } else {
+        pool.enqueue([this, target]() {
+            remove_file(*target, target->parent_fd, target->name.c_str(),
+                        fs::path(target->path).parent_path().string());
+            finish_target(*target);
+        });
+    }
+}
+
+void DeletionEngine::fail(Target& target, const std::string& path, int error) {
+    target.failed.store(true, std::memory_order_relaxed);
+    failure_count.fetch_add(1, std::memory_order_relaxed);
+    std::lock_guard<std::mutex> lock(failure_mutex);
+    if (failures.size() < MAX_KEPT_FAILURES) {
+        failures.push_back({path, error});
+    }
+}
+
+bool DeletionEngine::remove_file(Target& target, int dir_fd, const char* name,
+                                 const std::string& dir_path) {
+    // Only the last link gives the blocks back, unless every link was counted
+    EntryStat st;
+    uint64_t size = 0;
+    if (stat_entry_at(dir_fd, name, st) && st.type == DirEntryType::Regular &&
+        (st.nlink <= 1 || config.count_hard_links)) {
+        size = config.apparent_size ? st.size : get_size_on_disk(st);
+    }
+
+    if (unlinkat(dir_fd, name, 0) != 0) {
+        fail(target, dir_path + "/" + name, errno);
+        return false;
+    }
+
+    removed.fetch_add(1, std::memory_order_relaxed);
+    if (size > 0) {
+        target.freed.fetch_add(size, std::memory_order_relaxed);
+        target.entries.fetch_add(1, std::memory_order_relaxed);
+        freed.fetch_add(size, std::memory_order_relaxed);
+    }
+    return true;
+}
+
+void DeletionEngine::remove_directory(Job* job) {
+    int parent_fd = job->parent ? job->parent->fd : job->target->parent_fd;
+    auto listing = std::make_unique<DirListing>();
+    if (!listing->read_at(parent_fd, job->name.c_str()) || listing->last_error() != 0) {
+        fail(*job->target, job->path, listing->last_error());
+        job->failed.store(true, std::memory_order_relaxed);
+        finish_job(job);
+        return;
+    }
+    job->fd = listing->release_fd();
+
+    std::vector<const char*> subdirs;
+    listing->for_each([&](const DirRecord& record) {
+        DirEntryType type = record.type;
+        if (type == DirEntryType::Unknown) {
+            EntryStat st;
+            if (stat_entry_at(job->fd, record.name, st)) {
+                type = st.type;
+            }
+        }
+        if (type == DirEntryType::Directory) {
+            subdirs.push_back(record.name);
+        } else {
+            job->files.push_back(record.name);
+        }
+    });
+    job->listing = std::move(listing);  // The names point into its buffers
+
+    for (const char* name : subdirs) {
+        Job* child = new Job();
+        child->target = job->target;
+        child->parent = job;
+        child->name = name;
+        child->path = job->path + "/" + name;
+        job->pending.fetch_add(1, std::memory_order_relaxed);
+        pool.enqueue([this, child]() {
+            remove_directory(child);
+        });
+    }
+
+    // Other workers take the files past the first chunk
+    const size_t count = job->files.size();
+    for (size_t begin = UNLINK_CHUNK; begin < count; begin += UNLINK_CHUNK) {
+        uint32_t first = static_cast<uint32_t>(begin);
+        uint32_t last = static_cast<uint32_t>(std::min(begin + UNLINK_CHUNK, count));
+        job->pending.fetch_add(1, std::memory_order_relaxed);
+        pool.enqueue([this, job, first, last]() {
+            unlink_chunk(job, first, last);
+            finish_job(job);
+        });
+    }
+    unlink_chunk(job, 0, std::min(count, UNLINK_CHUNK));
+    finish_job(job);
+}
+
+void DeletionEngine::unlink_chunk(Job* job, size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i) {
+        if (!remove_file(*job->target, job->fd, job->files[i], job->path)) {
+            job->failed.store(true, std::memory_order_relaxed);
+        }
+    }
+}
+
+void DeletionEngine::finish_job(Job* job) {
+    // Walk up for as long as this thread is the last one out of a directory
+    while (job && job->pending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        Job* parent = job->parent;
+        Target& target = *job->target;
+        if (job->fd >= 0) {
+            close(job->fd);
+        }
+
+        bool failed = job->failed.load(std::memory_order_relaxed);
+        if (!failed) {
+            int parent_fd = parent ? parent->fd : target.parent_fd;
+            if (unlinkat(parent_fd, job->name.c_str(), AT_REMOVEDIR) == 0) {
+                removed.fetch_add(1, std::memory_order_relaxed);
+            } else {
+                fail(target, job->path, errno);
+                failed = true;
+            }
+        }
+        if (failed && parent) {
+            parent->failed.store(true, std::memory_order_relaxed);
+        }
+
+        delete job;
+        if (!parent) {
+            finish_target(target);
+        }
+        job = parent;
+    }
+}
+
+void DeletionEngine::finish_target(Target& target) {
+    if (target.parent_fd >= 0) {
+        close(target.parent_fd);
+        target.parent_fd = -1;
+    }
+    target.finished.store(true, std::memory_order_release);
+    running.fetch_sub(1, std::memory_order_acq_rel);
+}
+
+void DeletionEngine::collect(std::vector<Outcome>& out) {
+    out.clear();
+    for (auto it = targets.begin(); it != targets.end();) {
+        Target& target = **it;
+        // Read finished first: once set, the counters below are final
+        bool finished = target.finished.load(std::memory_order_acquire);
+        uint64_t target_freed = target.freed.load(std::memory_order_relaxed);
+        uint64_t target_entries = target.entries.load(std::memory_order_relaxed);
+
+        if (finished || target_freed != target.reported_freed ||
+            target_entries != target.reported_entries) {
+            out.push_back({target.node, target_freed - target.reported_freed,
+                           target_entries - target.reported_entries, finished,
+                           finished && target.failed.load(std::memory_order_relaxed)});
+            target.reported_freed = target_freed;
+            target.reported_entries = target_entries;
+        }
+        it = finished ? targets.erase(it) : it + 1;
+    }
+}
+
+std::vector<DeletionEngine::Failure> DeletionEngine::take_failures() {
+    std::lock_guard<std::mutex> lock(failure_mutex);
+    std::vector<Failure> taken;
+    taken.swap(failures);
+    return taken;
+}
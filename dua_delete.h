@@ -0,0 +1,100 @@
+// dua_delete.h - Removing marked entries on the worker pool
+#ifndef DUA_DELETE_H
+#define DUA_DELETE_H
+
+#include "dua_core.h"
+
+// Removes whole subtrees in parallel. Each directory is opened relative to
+// its parent's fd without following symlinks and emptied with unlinkat, so
+// a path swapped for a symlink halfway through cannot redirect the removal.
+// Large directories are unlinked in chunks by several workers at once.
+// Nothing here touches the NodeStore: the UI collects the freed bytes per
+// target and applies them to the tree itself.
+class DeletionEngine {
+public:
+    static constexpr size_t UNLINK_CHUNK = 2048;
+    static constexpr size_t MAX_KEPT_FAILURES = 1000;
+
+    struct Failure {
+        std::string path;
+        int error;
+    };
+
+    // What a target freed since the last collect()
+    struct Outcome {
+        NodeId node;
+        uint64_t freed;
+        uint64_t entries;       // Non-empty files, as in Node::entry_count
+        bool finished;
+        bool failed;            // Something below it is still there
+    };
+
+private:
+    struct Target {
+        NodeId node;
+        std::string path;
+        std::string name;       // Within the parent directory
+        int parent_fd = -1;
+        std::atomic<uint64_t> freed{0};
+        std::atomic<uint64_t> entries{0};
+        std::atomic<bool> failed{false};
+        std::atomic<bool> finished{false};
+        uint64_t reported_freed = 0;
+        uint64_t reported_entries = 0;
+    };
+
+    // A directory being emptied. pending counts its own listing plus each
+    // subdirectory and unlink chunk still running; whoever drops it to zero
+    // removes the directory and moves on to the parent.
+    struct Job {
+        Target* target;
+        Job* parent;
+        std::string path;
+        std::string name;       // Within the parent
+        int fd = -1;
+        std::unique_ptr<DirListing> listing;
+        std::vector<const char*> files;
+        std::atomic<uint32_t> pending{1};
+        std::atomic<bool> failed{false};
+    };
+
+    WorkStealingThreadPool& pool;
+    const Config& config;
+    std::vector<std::unique_ptr<Target>> targets;
+    std::atomic<size_t> running{0};
+    std::atomic<size_t> removed{0};
+    std::atomic<uint64_t> freed{0};
+    std::atomic<size_t> failure_count{0};
+    std::vector<Failure> failures;
+    std::mutex failure_mutex;
+
+    void fail(Target& target, const std::string& path, int error);
+    bool remove_file(Target& target, int dir_fd, const char* name, const std::string& dir_path);
+    void remove_directory(Job* job);
+    void unlink_chunk(Job* job, size_t begin, size_t end);
+    void finish_job(Job* job);
+    void finish_target(Target& target);
+
+public:
+    DeletionEngine(WorkStealingThreadPool& workers, const Config& cfg);
+    // Waits for removals still in flight
+    ~DeletionEngine();
+    DeletionEngine(const DeletionEngine&) = delete;
+    DeletionEngine& operator=(const DeletionEngine&) = delete;
+
+    // Queue node's entry at path for removal and return at once
+    void remove(NodeId node, const fs::path& path);
+    bool busy() const { return running.load(std::memory_order_acquire) > 0; }
+    void wait();
+
+    // Progress per target since the last call; finished targets are
+    // reported once more and then forgotten
+    void collect(std::vector<Outcome>& out);
+    std::vector<Failure> take_failures();
+
+    size_t removed_count() const { return removed.load(std::memory_order_relaxed); }
+    uint64_t freed_bytes() const { return freed.load(std::memory_order_relaxed); }
+    size_t failed_count() const { return failure_count.load(std::memory_order_relaxed); }
+};
+
+#endif // DUA_DELETE_H
@@ -3,6 +3,11 @@
 
 #include "dua_core.h"
 #include "dua_ui.h"
+#include "dua_snapshot.h"
+#include <csignal>
+#include <ctime>
+#include <poll.h>
+#include <termios.h>
 
 // Define color constants
 const std::string RESET = "\033[0m";
@@ -17,43 +22,18 @@ const std::string GRAY = "\033[90m";
 const std::string CLEAR_LINE = "\033[2K\r";
 
 // Function declarations
-void aggregate_mode(Config& config);
+int aggregate_mode(Config& config);
+bool load_requested_snapshot(Config& config, NodeStore& store, std::vector<NodeId>& roots,
+                             SnapshotInfo& info);
+bool save_requested_snapshot(const Config& config, const NodeStore& store,
+                             const std::vector<NodeId>& roots, int64_t started);
+void use_previous_snapshot(const Config& config, OptimizedScanner& scanner, NodeStore& previous,
+                           std::vector<NodeId>& previous_roots);
+std::vector<NodeId> scan_adjusting_rate(OptimizedScanner& scanner, 
+                                        const std::vector<fs::path>& paths);
 void print_usage(const char* program_name);
 void print_version();
 
-// Entry implementation
-Entry::Entry(const fs::path& p) : path(p) {
-    children.reserve(PREALLOCATE_ENTRIES);
-    try {
-        if (fs::exists(path)) {
-            auto status = fs::symlink_status(path);
-            is_symlink = fs::is_symlink(status);
-            
-            if (is_symlink) {
-                try {
-                    symlink_target = fs::read_symlink(path);
-                } catch (...) {
-                    symlink_target = fs::path("[unreadable]");
-                }
-                last_modified = fs::file_time_type{};
-            } else {
-                last_modified = fs::last_write_time(path);
-                
-#ifdef __linux__
-                struct stat st;
-                if (stat(path.c_str(), &st) == 0) {
-                    device_id = st.st_dev;
-                    inode = st.st_ino;
-                    hard_link_count = st.st_nlink;
-                }
-#endif
-            }
-        }
-    } catch (...) {
-        last_modified = fs::file_time_type{};
-    }
-}
-
 // ProgressThrottle implementation
 ProgressThrottle::ProgressThrottle(std::chrono::milliseconds interval) 
     : update_interval(interval) {
@@ -79,72 +59,204 @@ void ProgressThrottle::clear_line() const {
     }
 }
 
+// Snapshot helpers
+bool load_requested_snapshot(Config& config, NodeStore& store, std::vector<NodeId>& roots,
+                             SnapshotInfo& info) {
+    std::string error;
+    if (!load_snapshot(config.load_snapshot_path, store, roots, info, error)) {
+        std::cerr << "Error: " << error << "\n";
+        return false;
+    }
+    
+    // Show and refresh the tree the way it was scanned
+    apply_snapshot_flags(info, config);
+    config.paths.clear();
+    for (NodeId root : roots) {
+        config.paths.push_back(std::string(store.name(root)));
+    }
+    return true;
+}
+
+bool save_requested_snapshot(const Config& config, const NodeStore& store,
+                             const std::vector<NodeId>& roots, int64_t started) {
+    if (config.save_snapshot_path.empty()) return true;
+    
+    std::string error;
+    if (!save_snapshot(config.save_snapshot_path, store, roots, config, started, error)) {
+        std::cerr << "Error: " << error << "\n";
+        return false;
+    }
+    return true;
+}
+
+void use_previous_snapshot(const Config& config, OptimizedScanner& scanner, NodeStore& previous,
+                           std::vector<NodeId>& previous_roots) {
+    if (config.incremental_path.empty()) return;
+    
+    // Without a usable snapshot the scan simply lists everything
+    SnapshotInfo info;
+    std::string error;
+    if (!load_snapshot(config.incremental_path, previous, previous_roots, info, error)) {
+        std::cerr << "Warning: " << error << ", scanning everything\n";
+        return;
+    }
+    Config taken_with;
+    apply_snapshot_flags(info, taken_with);
+    if (taken_with.apparent_size != config.apparent_size ||
+        taken_with.count_hard_links != config.count_hard_links ||
+        taken_with.stay_on_filesystem != config.stay_on_filesystem ||
+        info.ignored_digest != ignored_dirs_digest(config)) {
+        std::cerr << "Warning: " << config.incremental_path.string() 
+                  << " was taken with different options, scanning everything\n";
+        return;
+    }
+    scanner.set_previous(previous, previous_roots, info.created);
+}
+
+// The terminal settings scan_adjusting_rate replaced, put back by
+// restore_terminal if a signal ends the program in the middle of it
+static struct termios scan_terminal;
+static constexpr int TERMINATING_SIGNALS[] = {SIGINT, SIGTERM, SIGHUP, SIGQUIT};
+
+static void restore_terminal(int sig) {
+    tcsetattr(STDIN_FILENO, TCSANOW, &scan_terminal);
+    // The handler was reset on entry; the signal is delivered on return
+    raise(sig);
+}
+
+// Scan on a thread of its own while + and - typed at the terminal move the
+// --polite cap; the progress line shows the rate that results
+std::vector<NodeId> scan_adjusting_rate(OptimizedScanner& scanner, 
+                                        const std::vector<fs::path>& paths) {
+    struct termios saved;
+    if (!isatty(STDIN_FILENO) || tcgetattr(STDIN_FILENO, &saved) != 0) {
+        return scanner.scan(paths);
+    }
+    struct termios keys = saved;
+    keys.c_lflag &= ~(ICANON | ECHO);
+    keys.c_cc[VMIN] = 0;
+    keys.c_cc[VTIME] = 0;
+    scan_terminal = saved;
+    struct sigaction restore;
+    std::memset(&restore, 0, sizeof(restore));
+    restore.sa_handler = restore_terminal;
+    sigemptyset(&restore.sa_mask);
+    restore.sa_flags = SA_RESETHAND;
+    struct sigaction previous[std::size(TERMINATING_SIGNALS)];
+    for (size_t i = 0; i < std::size(TERMINATING_SIGNALS); ++i) {
+        sigaction(TERMINATING_SIGNALS[i], &restore, &previous[i]);
+    }
+    tcsetattr(STDIN_FILENO, TCSANOW, &keys);
+    
+    std::vector<NodeId> roots;
+    std::atomic<bool> done{false};
+    std::thread scan_thread([&] {
+        roots = scanner.scan(paths);
+        done.store(true, std::memory_order_release);
+    });
+    
+    while (!done.load(std::memory_order_acquire)) {
+        struct pollfd input{STDIN_FILENO, POLLIN, 0};
+        if (poll(&input, 1, 100) <= 0) continue;
+        char ch;
+        while (read(STDIN_FILENO, &ch, 1) == 1) {
+            if (ch == '+' || ch == '-') {
+                scanner.set_ops_limit(step_ops_limit(scanner.ops_limit(), ch == '+'));
+            }
+        }
+    }
+    scan_thread.join();
+    tcsetattr(STDIN_FILENO, TCSANOW, &saved);
+    for (size_t i = 0; i < std::size(TERMINATING_SIGNALS); ++i) {
+        sigaction(TERMINATING_SIGNALS[i], &previous[i], nullptr);
+    }
+    return roots;
+}
+
 // Aggregate mode implementation
-void aggregate_mode(Config& config) {
-    WorkStealingThreadPool pool(config.thread_count);
-    OptimizedScanner scanner(pool, config);
+int aggregate_mode(Config& config) {
+    WorkStealingThreadPool pool(config.thread_count, config.polite);
+    NodeStore store(pool.size());
+    OptimizedScanner scanner(pool, config, store);
+    NodeStore previous;
+    std::vector<NodeId> previous_roots;
+    std::vector<NodeId> roots;
+    SnapshotInfo snapshot;
+    bool loaded = !config.load_snapshot_path.empty();
+    auto load_start = std::chrono::steady_clock::now();
     
-    auto roots = scanner.scan(config.paths);
+    if (loaded) {
+        if (!load_requested_snapshot(config, store, roots, snapshot)) {
+            return 1;
+        }
+    } else {
+        // The plain listing only needs per-root totals and the tree only the
+        // levels it prints, so nothing deeper gets a node
+        int keep_depth = config.tree_mode ? config.max_depth : 0;
+        if (config.bench_paths || !config.save_snapshot_path.empty()) {
+            keep_depth = -1;
+        }
+        use_previous_snapshot(config, scanner, previous, previous_roots);
+        int64_t started = std::time(nullptr);
+        roots = scanner.scan(config.paths, keep_depth);
+        if (!save_requested_snapshot(config, store, roots, started)) {
+            return 1;
+        }
+    }
+    auto load_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - load_start).count();
     
     if (config.tree_mode) {
         std::cout << "\n";
         
         if (roots.size() == 1) {
-            print_tree_sorted(roots[0], config);
+            print_tree_sorted(store, roots[0], config);
         } else {
-            auto virtual_root = std::make_shared<Entry>("[Total]");
-            virtual_root->is_directory = true;
-            
-            for (auto& root : roots) {
-                virtual_root->children.push_back(root);
-                virtual_root->size += root->size.load();
-                virtual_root->entry_count += root->entry_count.load();
-            }
-            
-            std::sort(virtual_root->children.begin(), virtual_root->children.end(),
-                [](const std::shared_ptr<Entry>& a, const std::shared_ptr<Entry>& b) {
-                    return a->size.load() > b->size.load();
-                });
-            
-            print_tree_sorted(virtual_root, config);
+            NodeId virtual_root = store.make_virtual("[Total]", roots);
+            print_tree_sorted(store, virtual_root, config);
         }
         
         std::cout << "\n";
     } else {
         std::sort(roots.begin(), roots.end(),
-            [](const std::shared_ptr<Entry>& a, const std::shared_ptr<Entry>& b) {
-                return a->size.load() < b->size.load();
+            [&store](NodeId a, NodeId b) {
+                return store[a].size < store[b].size;
             });
         
-        for (auto& root : roots) {
+        for (NodeId id : roots) {
+            const Node& root = store[id];
             std::cout << std::setw(12) << std::right 
-                      << format_size(root->size, config.format) << " ";
+                      << format_size(root.size, config.format) << " ";
             
             if (!config.no_colors) {
-                if (root->is_symlink) {
+                if (root.is_symlink()) {
                     std::cout << MAGENTA;
-                } else if (root->is_directory) {
+                } else if (root.is_directory()) {
                     std::cout << CYAN;
                 }
             }
             
-            std::cout << root->path;
+            std::cout << store.path(id);
             
-            if (root->is_symlink) {
-                std::cout << " -> " << root->symlink_target.string();
+            if (root.is_symlink()) {
+                std::cout << " -> " << store.symlink_target(id);
             }
             
-            if (!config.no_colors && (root->is_symlink || root->is_directory)) {
+            if (!config.no_colors && (root.is_symlink() || root.is_directory())) {
                 std::cout << RESET;
             }
             
+            if (root.is_incomplete()) {
+                std::cout << " (incomplete)";
+            }
+            
             std::cout << "\n";
         }
         
         if (roots.size() > 1) {
             uintmax_t total = 0;
-            for (auto& root : roots) {
-                total += root->size.load();
+            for (NodeId id : roots) {
+                total += store[id].size;
             }
             
             std::cout << std::setw(12) << std::right 
@@ -153,7 +265,27 @@ void aggregate_mode(Config& config) {
         }
     }
     
-    scanner.print_stats();
+    if (loaded) {
+        std::time_t created = static_cast<std::time_t>(snapshot.created);
+        char when[32];
+        std::strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", std::localtime(&created));
+        
+        uintmax_t total = 0;
+        for (NodeId id : roots) {
+            total += store[id].size;
+        }
+        std::cerr << "\nLoaded snapshot of " << snapshot.node_count << " entries scanned "
+                  << when << " (" << format_size(snapshot.file_size, config.format) 
+                  << ") in " << load_ms << "ms\n";
+        std::cerr << "Total size: " << format_size(total, config.format) << "\n";
+    } else {
+        scanner.print_stats();
+    }
+    
+    if (config.bench_paths) {
+        benchmark_path_reconstruction(store, roots);
+    }
+    return 0;
 }
 
 void print_usage(const char* program_name) {
@@ -173,11 +305,26 @@ void print_usage(const char* program_name) {
     std::cout << "  -t, --top N             Show only top N entries by size\n";
     std::cout << "  -T, --tree              Display results as a tree (aggregate mode)\n";
     std::cout << "  -f, --format FMT        Output format: metric, binary, bytes, gb, gib, mb, mib\n";
-    std::cout << "  -j, --threads N         Number of threads (default: auto)\n";
+    std::cout << "  -j, --threads N         Number of threads (default: adapts up to the CPU quota)\n";
     std::cout << "  -i, --ignore-dirs DIR   Directories to ignore (can be repeated)\n";
+    std::cout << "  --stat-engine ENGINE    Metadata engine: sync (default) or io_uring\n";
+    std::cout << "  --timeout SECS          Abandon directories that hang longer than this (default: 5)\n";
+    std::cout << "  --device-limit PATH=N   List at most N directories at once on PATH's device\n";
+    std::cout << "                          (default: 2 on spinning disks, 0 = no limit)\n";
+    std::cout << "  --polite                Scan at idle I/O and CPU priority, at most 500 metadata\n";
+    std::cout << "                          operations/s (interactive mode: change with +/-)\n";
+    std::cout << "  --polite-ops N          Like --polite, at most N operations/s\n";
     std::cout << "  --no-entry-check        Don't check entries for presence (faster but may show stale data)\n";
     std::cout << "  --no-colors             Disable colored output\n";
-    std::cout << "  --no-progress           Disable progress reporting\n\n";
+    std::cout << "  --no-progress           Disable progress reporting\n";
+    std::cout << "  --bench-paths           Time full-path reconstruction after the scan\n";
+    std::cout << "  --save-snapshot FILE    Save the scanned tree to FILE\n";
+    std::cout << "  --load-snapshot FILE    Show a saved tree instead of scanning\n";
+    std::cout << "  --incremental FILE      Only list directories changed since snapshot FILE\n";
+    std::cout << "  --trust-mtime           With --incremental, keep recorded file sizes in\n";
+    std::cout << "                          unchanged directories instead of stat'ing them\n";
+    std::cout << "  --watch                 Follow changes while browsing (interactive mode,\n";
+    std::cout << "                          toggle with w)\n\n";
     std::cout << "If no path is provided, the current directory is used.\n";
 }
 
@@ -219,6 +366,31 @@ int main(int argc, char* argv[]) {
             config.no_colors = true;
         } else if (arg == "--no-progress") {
             config.show_progress = false;
+        } else if (arg == "--bench-paths") {
+            config.bench_paths = true;
+        } else if (arg == "--save-snapshot") {
+            if (i + 1 < args.size()) {
+                config.save_snapshot_path = args[++i];
+            }
+        } else if (arg == "--load-snapshot") {
+            if (i + 1 < args.size()) {
+                config.load_snapshot_path = args[++i];
+            }
+        } else if (arg == "--incremental") {
+            if (i + 1 < args.size()) {
+                config.incremental_path = args[++i];
+            }
+        } else if (arg == "--trust-mtime") {
+            config.trust_mtime = true;
+        } else if (arg == "--watch") {
+            config.watch = true;
+        } else if (arg == "--polite") {
+            config.polite = true;
+        } else if (arg == "--polite-ops") {
+            if (i + 1 < args.size()) {
+                config.polite = true;
+                config.polite_ops = std::max<size_t>(MIN_POLITE_OPS, std::stoul(args[++i]));
+            }
         } else if (arg == "-d" || arg == "--depth") {
             if (i + 1 < args.size()) {
                 config.max_depth = std::stoi(args[++i]);
@@ -235,6 +407,34 @@ int main(int argc, char* argv[]) {
                 std::transform(config.format.begin(), config.format.end(), 
                              config.format.begin(), ::tolower);
             }
+        } else if (arg == "--stat-engine") {
+            if (i + 1 < args.size()) {
+                config.stat_engine = args[++i];
+                if (config.stat_engine != "sync" && config.stat_engine != "io_uring") {
+                    std::cerr << "Unknown stat engine: " << config.stat_engine << "\n";
+                    return 1;
+                }
+            }
+        } else if (arg == "--timeout") {
+            if (i + 1 < args.size()) {
+                config.fs_timeout = std::chrono::milliseconds(
+                    static_cast<long long>(std::stod(args[++i]) * 1000));
+            }
+        } else if (arg == "--device-limit") {
+            if (i + 1 < args.size()) {
+                const std::string& spec = args[++i];
+                size_t eq = spec.rfind('=');
+                try {
+                    if (eq == std::string::npos || eq == 0) {
+                        throw std::invalid_argument(spec);
+                    }
+                    config.device_limits.push_back({spec.substr(0, eq), 
+                                                    std::stoul(spec.substr(eq + 1))});
+                } catch (...) {
+                    std::cerr << "Invalid device limit (expected PATH=N): " << spec << "\n";
+                    return 1;
+                }
+            }
         } else if (arg == "-j" || arg == "--threads") {
             if (i + 1 < args.size()) {
                 config.thread_count = std::stoi(args[++i]);
@@ -260,10 +460,13 @@ int main(int argc, char* argv[]) {
         config.paths.push_back(".");
     }
     
-    for (const auto& path : config.paths) {
-        if (!fs::exists(path)) {
-            std::cerr << "Error: Path does not exist: " << path << "\n";
-            return 1;
+    // A snapshot brings its own paths
+    if (config.load_snapshot_path.empty()) {
+        for (const auto& path : config.paths) {
+            if (!fs::exists(path)) {
+                std::cerr << "Error: Path does not exist: " << path << "\n";
+                return 1;
+            }
         }
     }
     
@@ -272,20 +475,39 @@ int main(int argc, char* argv[]) {
     }
     
     if (config.interactive_mode) {
-        WorkStealingThreadPool pool(config.thread_count);
-        OptimizedScanner scanner(pool, config);
+        WorkStealingThreadPool pool(config.thread_count, config.polite);
+        NodeStore store(pool.size());
+        OptimizedScanner scanner(pool, config, store);
+        // The scanner keeps pointing at these, so they live as long as it
+        NodeStore previous;
+        std::vector<NodeId> previous_roots;
         
         auto start = std::chrono::high_resolution_clock::now();
-        auto roots = scanner.scan(config.paths);
+        std::vector<NodeId> roots;
+        if (!config.load_snapshot_path.empty()) {
+            SnapshotInfo snapshot;
+            if (!load_requested_snapshot(config, store, roots, snapshot)) {
+                return 1;
+            }
+        } else {
+            use_previous_snapshot(config, scanner, previous, previous_roots);
+            int64_t started = std::time(nullptr);
+            roots = config.polite ? scan_adjusting_rate(scanner, config.paths) 
+                                  : scanner.scan(config.paths);
+            config.polite_ops = scanner.ops_limit();
+            if (!save_requested_snapshot(config, store, roots, started)) {
+                return 1;
+            }
+        }
         auto end = std::chrono::high_resolution_clock::now();
         
         auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
         
-        InteractiveUI ui(roots, config);
+        InteractiveUI ui(pool, store, roots, config);
         ui.set_scan_time(duration.count());
         ui.run();
     } else {
-        aggregate_mode(config);
+        return aggregate_mode(config);
     }
     
     return 0;
@@ -0,0 +1,580 @@
+// dua_fs.cpp - Low-level filesystem access implementation
+#include "dua_fs.h"
+#include <cerrno>
+#include <algorithm>
+#include <fstream>
+#include <string>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/sysmacros.h>
+#include <linux/io_uring.h>
+#else
+#include <dirent.h>
+#endif
+
+static void fill_entry_stat(const struct stat& st, EntryStat& out) {
+    out.size = static_cast<uintmax_t>(st.st_size);
+    out.blocks = static_cast<uintmax_t>(st.st_blocks);
+#ifdef __APPLE__
+    out.mtime_sec = st.st_mtimespec.tv_sec;
+    out.mtime_nsec = static_cast<uint32_t>(st.st_mtimespec.tv_nsec);
+    out.ctime_sec = st.st_ctimespec.tv_sec;
+    out.ctime_nsec = static_cast<uint32_t>(st.st_ctimespec.tv_nsec);
+#else
+    out.mtime_sec = st.st_mtim.tv_sec;
+    out.mtime_nsec = static_cast<uint32_t>(st.st_mtim.tv_nsec);
+    out.ctime_sec = st.st_ctim.tv_sec;
+    out.ctime_nsec = static_cast<uint32_t>(st.st_ctim.tv_nsec);
+#endif
+    out.device = st.st_dev;
+    out.inode = st.st_ino;
+    out.nlink = st.st_nlink;
+    
+    if (S_ISREG(st.st_mode)) out.type = DirEntryType::Regular;
+    else if (S_ISDIR(st.st_mode)) out.type = DirEntryType::Directory;
+    else if (S_ISLNK(st.st_mode)) out.type = DirEntryType::Symlink;
+    else out.type = DirEntryType::Other;
+}
+
+bool stat_entry_at(int dir_fd, const char* name, EntryStat& out) {
+    struct stat st;
+    if (fstatat(dir_fd, name, &st, AT_SYMLINK_NOFOLLOW) != 0) {
+        return false;
+    }
+    fill_entry_stat(st, out);
+    return true;
+}
+
+bool stat_entry(const fs::path& path, EntryStat& out) {
+    struct stat st;
+    if (lstat(path.c_str(), &st) != 0) {
+        return false;
+    }
+    fill_entry_stat(st, out);
+    return true;
+}
+
+bool stat_entry_fd(int fd, EntryStat& out) {
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        return false;
+    }
+    fill_entry_stat(st, out);
+    return true;
+}
+
+bool is_rotational_device([[maybe_unused]] dev_t device) {
+#ifdef __linux__
+    // Partitions keep the queue attributes in the parent disk's directory
+    std::string base = "/sys/dev/block/" + std::to_string(major(device)) + ":" + 
+                       std::to_string(minor(device));
+    for (const char* attribute : {"/queue/rotational", "/../queue/rotational"}) {
+        std::ifstream in(base + attribute);
+        int rotational;
+        if (in >> rotational) {
+            return rotational == 1;
+        }
+    }
+#endif
+    return false;
+}
+
+bool make_thread_idle() {
+#ifdef __linux__
+    // IOPRIO_PRIO_VALUE(IOPRIO_CLASS_IDLE, 0) for IOPRIO_WHO_PROCESS;
+    // <linux/ioprio.h> is missing from older headers. Both calls take the
+    // calling thread alone, not the whole process.
+    constexpr int who_process = 1;
+    constexpr int idle_class = 3 << 13;
+    bool ok = syscall(SYS_ioprio_set, who_process, 0, idle_class) == 0;
+    int saved = errno;
+    
+    struct sched_param param{};
+    int error = pthread_setschedparam(pthread_self(), SCHED_IDLE, &param);
+    if (error != 0) {
+        ok = false;
+        saved = error;
+    }
+    errno = saved;
+    return ok;
+#else
+    errno = ENOTSUP;
+    return false;
+#endif
+}
+
+#ifdef __linux__
+// IoUringStatx implementation
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params* p) {
+    return static_cast<int>(syscall(__NR_io_uring_setup, entries, p));
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return static_cast<int>(syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0));
+}
+
+static int sys_io_uring_register(int fd, unsigned opcode, void* arg, unsigned nr_args) {
+    return static_cast<int>(syscall(__NR_io_uring_register, fd, opcode, arg, nr_args));
+}
+
+IoUringStatx::~IoUringStatx() {
+    if (sqe_ptr) munmap(sqe_ptr, sqe_size);
+    if (cq_ptr && cq_ptr != sq_ptr) munmap(cq_ptr, cq_size);
+    if (sq_ptr) munmap(sq_ptr, sq_size);
+    if (ring_fd >= 0) close(ring_fd);
+}
+
+bool IoUringStatx::init(unsigned queue_depth) {
+    struct io_uring_params params;
+    std::memset(&params, 0, sizeof(params));
+    ring_fd = sys_io_uring_setup(queue_depth, &params);
+    if (ring_fd < 0) {
+        return false;
+    }
+    entries = params.sq_entries;
+    
+    sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    bool single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single_mmap) {
+        sq_size = cq_size = std::max(sq_size, cq_size);
+    }
+    
+    sq_ptr = mmap(nullptr, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                  ring_fd, IORING_OFF_SQ_RING);
+    if (sq_ptr == MAP_FAILED) {
+        sq_ptr = nullptr;
+        return false;
+    }
+    if (single_mmap) {
+        cq_ptr = sq_ptr;
+    } else {
+        cq_ptr = mmap(nullptr, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      ring_fd, IORING_OFF_CQ_RING);
+        if (cq_ptr == MAP_FAILED) {
+            cq_ptr = nullptr;
+            return false;
+        }
+    }
+    sqe_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    sqe_ptr = mmap(nullptr, sqe_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                   ring_fd, IORING_OFF_SQES);
+    if (sqe_ptr == MAP_FAILED) {
+        sqe_ptr = nullptr;
+        return false;
+    }
+    
+    char* sq = static_cast<char*>(sq_ptr);
+    char* cq = static_cast<char*>(cq_ptr);
+    sq_head = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+    sq_tail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+    sq_mask = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+    sq_array = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+    cq_head = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+    cq_tail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+    cq_mask = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+    cqes = cq + params.cq_off.cqes;
+    
+    statx_buf.resize(static_cast<size_t>(entries) * sizeof(struct statx));
+    finished.resize(entries);
+    return true;
+}
+
+bool IoUringStatx::stat_batch(int dir_fd, const std::vector<const char*>& names,
+                              std::vector<EntryStat>& out, std::vector<char>& ok,
+                              const ReadCancel& cancel) {
+    out.assign(names.size(), EntryStat{});
+    ok.assign(names.size(), 0);
+    if (failed) return false;
+    auto* sqes = static_cast<struct io_uring_sqe*>(sqe_ptr);
+    auto* cq_entries = static_cast<struct io_uring_cqe*>(cqes);
+    auto* stx = reinterpret_cast<struct statx*>(statx_buf.data());
+    
+    size_t next = 0;
+    while (next < names.size()) {
+        if (cancel.requested()) return false;
+        unsigned chunk = static_cast<unsigned>(std::min<size_t>(names.size() - next, entries));
+        std::fill(finished.begin(), finished.begin() + chunk, 0);
+        
+        unsigned tail = __atomic_load_n(sq_tail, __ATOMIC_RELAXED);
+        for (unsigned i = 0; i < chunk; ++i) {
+            unsigned idx = tail & *sq_mask;
+            struct io_uring_sqe* sqe = &sqes[idx];
+            std::memset(sqe, 0, sizeof(*sqe));
+            sqe->opcode = IORING_OP_STATX;
+            sqe->fd = dir_fd;
+            sqe->addr = reinterpret_cast<uint64_t>(names[next + i]);
+            sqe->len = STATX_BASIC_STATS;
+            sqe->off = reinterpret_cast<uint64_t>(&stx[i]);
+            sqe->statx_flags = AT_SYMLINK_NOFOLLOW;
+            sqe->user_data = i;
+            sq_array[idx] = idx;
+            tail++;
+        }
+        __atomic_store_n(sq_tail, tail, __ATOMIC_RELEASE);
+        
+        unsigned to_submit = chunk;
+        unsigned completed = 0;
+        auto reap = [&]() {
+            unsigned head = __atomic_load_n(cq_head, __ATOMIC_RELAXED);
+            unsigned ctail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+            while (head != ctail) {
+                const struct io_uring_cqe& cqe = cq_entries[head & *cq_mask];
+                head++;
+                if (cqe.user_data & CANCEL_TAG) continue;
+                size_t i = static_cast<size_t>(cqe.user_data);
+                if (i < chunk) finished[i] = 1;
+                if (cqe.res == 0 && i < chunk) {
+                    const struct statx& sx = stx[i];
+                    EntryStat& st = out[next + i];
+                    st.size = sx.stx_size;
+                    st.blocks = sx.stx_blocks;
+                    st.mtime_sec = sx.stx_mtime.tv_sec;
+                    st.mtime_nsec = sx.stx_mtime.tv_nsec;
+                    st.ctime_sec = sx.stx_ctime.tv_sec;
+                    st.ctime_nsec = sx.stx_ctime.tv_nsec;
+                    st.device = makedev(sx.stx_dev_major, sx.stx_dev_minor);
+                    st.inode = sx.stx_ino;
+                    st.nlink = sx.stx_nlink;
+                    if (S_ISREG(sx.stx_mode)) st.type = DirEntryType::Regular;
+                    else if (S_ISDIR(sx.stx_mode)) st.type = DirEntryType::Directory;
+                    else if (S_ISLNK(sx.stx_mode)) st.type = DirEntryType::Symlink;
+                    else st.type = DirEntryType::Other;
+                    ok[next + i] = 1;
+                }
+                completed++;
+            }
+            __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+        };
+        
+        while (completed < chunk) {
+            // The watchdog's signal ends the wait below with EINTR
+            if (cancel.requested()) {
+                bool cancelled = cancel_chunk(chunk, to_submit);
+                int error = errno;
+                drain(chunk - to_submit, completed, reap);
+                errno = error;
+                failed = failed || !cancelled;
+                return false;
+            }
+            int ret = sys_io_uring_enter(ring_fd, to_submit, 1, IORING_ENTER_GETEVENTS);
+            if (ret < 0) {
+                if (errno == EINTR) continue;
+                int error = errno;
+                drain(chunk - to_submit, completed, reap);
+                errno = error;
+                failed = true;
+                return false;
+            }
+            to_submit -= std::min<unsigned>(to_submit, static_cast<unsigned>(ret));
+            reap();
+        }
+        next += chunk;
+    }
+    return true;
+}
+
+bool IoUringStatx::cancel_chunk(unsigned chunk, unsigned& to_submit) {
+    // Hand over what is still queued first: left in the ring, it would go
+    // out with the next batch. Then one cancel per unfinished request,
+    // which fit now that the queue is empty.
+    while (to_submit > 0) {
+        int ret = sys_io_uring_enter(ring_fd, to_submit, 0, 0);
+        if (ret < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        to_submit -= std::min<unsigned>(to_submit, static_cast<unsigned>(ret));
+    }
+    
+    auto* sqes = static_cast<struct io_uring_sqe*>(sqe_ptr);
+    unsigned tail = __atomic_load_n(sq_tail, __ATOMIC_RELAXED);
+    unsigned cancels = 0;
+    for (unsigned i = 0; i < chunk; ++i) {
+        if (finished[i]) continue;
+        unsigned idx = tail & *sq_mask;
+        struct io_uring_sqe* sqe = &sqes[idx];
+        std::memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->fd = -1;
+        sqe->addr = i;
+        sqe->user_data = CANCEL_TAG | i;
+        sq_array[idx] = idx;
+        tail++;
+        cancels++;
+    }
+    __atomic_store_n(sq_tail, tail, __ATOMIC_RELEASE);
+    
+    while (cancels > 0) {
+        int ret = sys_io_uring_enter(ring_fd, cancels, 0, 0);
+        if (ret < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        cancels -= std::min<unsigned>(cancels, static_cast<unsigned>(ret));
+    }
+    return true;
+}
+
+template<class Reap>
+void IoUringStatx::drain(unsigned submitted, unsigned& completed, Reap&& reap) {
+    // Submitted requests still write into statx_buf and read their names,
+    // so the caller may not free either until every one has completed
+    while (completed < submitted) {
+        if (sys_io_uring_enter(ring_fd, 0, 1, IORING_ENTER_GETEVENTS) < 0 &&
+            errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+            // No way left to wait for them: give them the buffer for good
+            // rather than let them write into freed memory
+            new std::vector<unsigned char>(std::move(statx_buf));
+            failed = true;
+            return;
+        }
+        reap();
+    }
+}
+
+bool IoUringStatx::supported(std::string& reason) {
+    IoUringStatx ring;
+    if (!ring.init(8)) {
+        reason = std::strerror(errno);
+        return false;
+    }
+    
+    const unsigned ops = 256;
+    std::vector<unsigned char> buf(sizeof(struct io_uring_probe) + ops * sizeof(struct io_uring_probe_op), 0);
+    auto* probe = reinterpret_cast<struct io_uring_probe*>(buf.data());
+    if (sys_io_uring_register(ring.ring_fd, IORING_REGISTER_PROBE, probe, ops) < 0) {
+        reason = "probe failed: " + std::string(std::strerror(errno));
+        return false;
+    }
+    if (probe->last_op < IORING_OP_STATX ||
+        !(probe->ops[IORING_OP_STATX].flags & IO_URING_OP_SUPPORTED)) {
+        reason = "kernel lacks IORING_OP_STATX";
+        return false;
+    }
+    return true;
+}
+#endif
+
+// DirListing implementation
+DirListing::~DirListing() {
+    if (dir_fd >= 0) {
+        close(dir_fd);
+    }
+}
+
+#ifdef __linux__
+bool DirListing::read(const fs::path& dir_path, const ReadCancel& cancel, RateLimiter* pace) {
+    return read_at(AT_FDCWD, dir_path.c_str(), cancel, pace);
+}
+
+bool DirListing::read_at(int parent_fd, const char* name, const ReadCancel& cancel,
+                         RateLimiter* pace) {
+    while (true) {
+        if (pace) pace->acquire(1, cancel);
+        dir_fd = openat(parent_fd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC | O_NOFOLLOW);
+        if (dir_fd >= 0) break;
+        if (errno == EINTR && !cancel.requested()) continue;
+        if (errno == EINTR) {
+            is_truncated = true;
+            return true;
+        }
+        error = errno;
+        return error == EACCES;
+    }
+
+    while (true) {
+        if (cancel.requested()) {
+            is_truncated = true;
+            break;
+        }
+        if (pace) pace->acquire(1, cancel);
+        Block block{std::unique_ptr<char[]>(new char[DIR_READ_BUFFER]), 0};
+        long n = syscall(SYS_getdents64, dir_fd, block.data.get(), DIR_READ_BUFFER);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            error = errno;
+            return false;
+        }
+        if (n == 0) break;
+
+        block.used = static_cast<size_t>(n);
+        size_t pos = 0;
+        while (pos < block.used) {
+            const char* rec = block.data.get() + pos;
+            unsigned short reclen;
+            std::memcpy(&reclen, rec + 16, sizeof(reclen));
+            const char* name = rec + 19;
+            if (!(name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))) {
+                count++;
+            }
+            pos += reclen;
+        }
+        blocks.push_back(std::move(block));
+    }
+    return true;
+}
+#else
+bool DirListing::read(const fs::path& dir_path, const ReadCancel& cancel, RateLimiter* pace) {
+    if (pace) pace->acquire(1, cancel);
+    dir_fd = open(dir_path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC | O_NOFOLLOW);
+    if (dir_fd < 0) {
+        error = errno;
+        return error == EACCES;
+    }
+    
+    std::error_code ec;
+    fs::directory_iterator it(dir_path, fs::directory_options::skip_permission_denied, ec);
+    if (ec) {
+        error = ec.value();
+        return false;
+    }
+
+    for (; it != fs::directory_iterator(); it.increment(ec)) {
+        if (cancel.requested()) {
+            is_truncated = true;
+            break;
+        }
+        if (ec) {
+            error = ec.value();
+            return false;
+        }
+        // symlink_status may stat the entry
+        if (pace) pace->acquire(1, cancel);
+        DirEntryType type = DirEntryType::Unknown;
+        std::error_code type_ec;
+        auto status = it->symlink_status(type_ec);
+        if (!type_ec) {
+            if (fs::is_symlink(status)) type = DirEntryType::Symlink;
+            else if (fs::is_directory(status)) type = DirEntryType::Directory;
+            else if (fs::is_regular_file(status)) type = DirEntryType::Regular;
+            else type = DirEntryType::Other;
+        }
+        names.push_back(it->path().filename().string());
+        types.push_back(type);
+        count++;
+    }
+    return true;
+}
+
+bool DirListing::read_at(int parent_fd, const char* name, const ReadCancel& cancel,
+                         RateLimiter* pace) {
+    if (pace) pace->acquire(1, cancel);
+    dir_fd = openat(parent_fd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC | O_NOFOLLOW);
+    if (dir_fd < 0) {
+        error = errno;
+        return error == EACCES;
+    }
+    
+    // readdir on a duplicate, so closedir leaves dir_fd open
+    int list_fd = dup(dir_fd);
+    DIR* dir = list_fd >= 0 ? fdopendir(list_fd) : nullptr;
+    if (!dir) {
+        error = errno;
+        if (list_fd >= 0) close(list_fd);
+        return false;
+    }
+    
+    while (struct dirent* entry = readdir(dir)) {
+        if (cancel.requested()) {
+            is_truncated = true;
+            break;
+        }
+        const char* entry_name = entry->d_name;
+        if (entry_name[0] == '.' && (entry_name[1] == '\0' || 
+                                     (entry_name[1] == '.' && entry_name[2] == '\0'))) {
+            continue;
+        }
+        DirEntryType type;
+        switch (entry->d_type) {
+            case DT_REG: type = DirEntryType::Regular; break;
+            case DT_DIR: type = DirEntryType::Directory; break;
+            case DT_LNK: type = DirEntryType::Symlink; break;
+            case DT_UNKNOWN: type = DirEntryType::Unknown; break;
+            default: type = DirEntryType::Other; break;
+        }
+        names.push_back(entry_name);
+        types.push_back(type);
+        count++;
+    }
+    closedir(dir);
+    return true;
+}
+#endif
+
+// RateLimiter implementation
+void RateLimiter::refill(Clock::time_point now, double per_second) {
+    double elapsed = std::chrono::duration<double>(now - refilled).count();
+    tokens = std::min(tokens + elapsed * per_second, std::max(1.0, per_second * BURST_SECONDS));
+    refilled = now;
+}
+
+void RateLimiter::set_rate(double per_second) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto now = Clock::now();
+        if (limited()) {
+            // Tokens earned so far count at the old rate
+            refill(now, limit());
+        } else {
+            tokens = std::max(1.0, per_second * BURST_SECONDS);
+            refilled = now;
+        }
+        rate.store(std::max(per_second, 0.0), std::memory_order_relaxed);
+    }
+    rate_changed.notify_all();
+}
+
+void RateLimiter::acquire(size_t count, const ReadCancel& cancel) {
+    if (!limited()) return;
+    
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        double per_second = limit();
+        if (per_second <= 0) return;
+        
+        auto now = Clock::now();
+        refill(now, per_second);
+        if (tokens > 0) {
+            tokens -= static_cast<double>(count);
+            taken += count;
+            return;
+        }
+        if (cancel.requested()) return;
+        
+        // Excused up front, so the deadline cannot pass while asleep, and
+        // set right afterwards by what the wait actually took
+        auto wait = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::duration<double>(-tokens / per_second)) + std::chrono::microseconds(100);
+        cancel.excuse(wait);
+        rate_changed.wait_for(lock, wait);
+        cancel.excuse(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            Clock::now() - now) - wait);
+    }
+}
+
+double RateLimiter::measured() {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto now = Clock::now();
+    if (sampled == Clock::time_point{}) {
+        sampled = now;
+        sampled_taken = taken;
+    } else if (now - sampled >= MEASURE_INTERVAL) {
+        sampled_rate = static_cast<double>(taken - sampled_taken) / 
+                       std::chrono::duration<double>(now - sampled).count();
+        sampled = now;
+        sampled_taken = taken;
+    }
+    return sampled_rate;
+}
+
+uint64_t RateLimiter::operations() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return taken;
+}
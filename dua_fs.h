@@ -0,0 +1,289 @@
+// dua_fs.h - Low-level filesystem access for the scanner
+#ifndef DUA_FS_H
+#define DUA_FS_H
+
+#include <filesystem>
+#include <vector>
+#include <string>
+#include <memory>
+#include <cstdint>
+#include <cstring>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifdef __linux__
+#include <dirent.h>
+#endif
+
+namespace fs = std::filesystem;
+
+// Size of each raw directory read (getdents64 buffer on Linux)
+constexpr size_t DIR_READ_BUFFER = 64 * 1024;
+
+// Entry type as reported by the directory listing itself
+enum class DirEntryType : uint8_t {
+    Unknown,    // Filesystem didn't fill in d_type, caller has to stat
+    Regular,
+    Directory,
+    Symlink,
+    Other       // Devices, sockets, fifos
+};
+
+// A single directory record; name points into the owning DirListing
+struct DirRecord {
+    const char* name;
+    uint64_t inode;
+    DirEntryType type;
+};
+
+// Metadata of one entry, filled from a single stat call
+struct EntryStat {
+    uintmax_t size = 0;         // Apparent size in bytes
+    uintmax_t blocks = 0;       // Allocated 512-byte blocks
+    int64_t mtime_sec = 0;
+    uint32_t mtime_nsec = 0;
+    int64_t ctime_sec = 0;
+    uint32_t ctime_nsec = 0;
+    dev_t device = 0;
+    ino_t inode = 0;
+    nlink_t nlink = 1;
+    DirEntryType type = DirEntryType::Unknown;
+};
+
+// Stat name relative to an open directory without following symlinks
+bool stat_entry_at(int dir_fd, const char* name, EntryStat& out);
+// Same for an absolute or cwd-relative path
+bool stat_entry(const fs::path& path, EntryStat& out);
+// Same for an open file or directory
+bool stat_entry_fd(int fd, EntryStat& out);
+// Whether the block device behind a filesystem spins, from sysfs; false
+// when it cannot tell (network and virtual filesystems, other platforms)
+bool is_rotational_device(dev_t device);
+// Move the calling thread to the idle I/O class and SCHED_IDLE, so it only
+// gets the disk and CPU time nobody else wants. False, with errno set, if
+// either could not be applied.
+bool make_thread_idle();
+
+#ifdef __linux__
+// Minimal io_uring instance that stats a whole batch of names relative to
+// one directory with IORING_OP_STATX requests. One instance per thread.
+struct ReadCancel;
+
+class IoUringStatx {
+private:
+    static constexpr uint64_t CANCEL_TAG = 1ull << 63;     // user_data of cancel requests
+
+    int ring_fd = -1;
+    unsigned entries = 0;
+    void* sq_ptr = nullptr;
+    void* cq_ptr = nullptr;
+    void* sqe_ptr = nullptr;
+    size_t sq_size = 0;
+    size_t cq_size = 0;
+    size_t sqe_size = 0;
+    unsigned* sq_head = nullptr;
+    unsigned* sq_tail = nullptr;
+    unsigned* sq_mask = nullptr;
+    unsigned* sq_array = nullptr;
+    unsigned* cq_head = nullptr;
+    unsigned* cq_tail = nullptr;
+    unsigned* cq_mask = nullptr;
+    void* cqes = nullptr;
+    std::vector<unsigned char> statx_buf;
+    std::vector<char> finished;     // Per request of the chunk in flight
+    bool failed = false;
+    
+    bool cancel_chunk(unsigned chunk, unsigned& to_submit);
+    template<class Reap>
+    void drain(unsigned submitted, unsigned& completed, Reap&& reap);
+    
+public:
+    IoUringStatx() = default;
+    ~IoUringStatx();
+    IoUringStatx(const IoUringStatx&) = delete;
+    IoUringStatx& operator=(const IoUringStatx&) = delete;
+    
+    // Set up the ring; returns false (with errno set) if io_uring is unusable
+    bool init(unsigned queue_depth);
+    
+    // Stat names[i] relative to dir_fd into out[i]; ok[i] is 0 on failure.
+    // Returns false if the ring itself failed and the caller must fall back;
+    // whatever was submitted has completed by then, but the ring is done for.
+    // Also returns false once cancel is requested: requests still in flight
+    // are cancelled and waited for, and the ring stays usable.
+    bool stat_batch(int dir_fd, const std::vector<const char*>& names,
+                    std::vector<EntryStat>& out, std::vector<char>& ok,
+                    const ReadCancel& cancel);
+    bool broken() const { return failed; }
+    
+    // Probe once whether this kernel supports io_uring with IORING_OP_STATX
+    static bool supported(std::string& reason);
+};
+#endif
+
+// Cancellation handle checked between blocking directory reads. The read
+// is cancelled once *flag holds this read's generation. A reader that
+// waits on purpose moves *started_ns on by as long, so the wait does not
+// count towards the deadline.
+struct ReadCancel {
+    const std::atomic<uint64_t>* flag = nullptr;
+    uint64_t generation = 0;
+    std::atomic<int64_t>* started_ns = nullptr;
+    
+    bool requested() const {
+        return flag && flag->load(std::memory_order_relaxed) == generation;
+    }
+    void excuse(std::chrono::nanoseconds waited) const {
+        if (started_ns) {
+            started_ns->fetch_add(waited.count(), std::memory_order_relaxed);
+        }
+    }
+};
+
+// Token bucket holding metadata syscalls to a rate shared by all threads.
+// Up to BURST_SECONDS worth of tokens build up. A caller goes ahead as
+// soon as there is any token left and may put the bucket in debt, which
+// the callers after it wait out. The rate can change at any time; callers
+// already waiting pick it up at once.
+class RateLimiter {
+public:
+    static constexpr double BURST_SECONDS = 0.1;
+    static constexpr auto MEASURE_INTERVAL = std::chrono::milliseconds(500);
+
+private:
+    using Clock = std::chrono::steady_clock;
+    std::atomic<double> rate{0};    // Operations per second, 0 = no limit
+    std::mutex mutex;
+    std::condition_variable rate_changed;
+    double tokens = 0;
+    Clock::time_point refilled;
+    uint64_t taken = 0;             // Operations let through while limited
+    Clock::time_point sampled;
+    uint64_t sampled_taken = 0;
+    double sampled_rate = 0;
+
+    void refill(Clock::time_point now, double per_second);
+
+public:
+    void set_rate(double per_second);
+    double limit() const { return rate.load(std::memory_order_relaxed); }
+    bool limited() const { return limit() > 0; }
+    // Wait until count more operations may go ahead. Gives up early once
+    // cancel is requested; the time waited is excused from its deadline.
+    void acquire(size_t count, const ReadCancel& cancel = ReadCancel{});
+    // Operations per second let through, over the last MEASURE_INTERVAL
+    double measured();
+    // Operations let through while limited, ever
+    uint64_t operations();
+};
+
+// Complete listing of one directory, read in large chunks straight from
+// the kernel and kept in the raw buffers it was read into
+class DirListing {
+private:
+    int dir_fd = -1;
+    size_t count = 0;
+    int error = 0;
+    bool is_truncated = false;
+#ifdef __linux__
+    struct Block {
+        std::unique_ptr<char[]> data;
+        size_t used;
+    };
+    std::vector<Block> blocks;
+#else
+    std::vector<std::string> names;
+    std::vector<DirEntryType> types;
+#endif
+
+public:
+    DirListing() = default;
+    ~DirListing();
+    DirListing(const DirListing&) = delete;
+    DirListing& operator=(const DirListing&) = delete;
+
+    // Read all entries of dir_path. Permission denied yields an empty
+    // listing; any other failure returns false with last_error() set.
+    // A cancelled read keeps what it got so far and reports truncated().
+    // With pace, the open and every read first take a token from it.
+    bool read(const fs::path& dir_path, const ReadCancel& cancel = ReadCancel{},
+              RateLimiter* pace = nullptr);
+    // Same for name relative to an open directory; a symlink is not followed
+    bool read_at(int parent_fd, const char* name, const ReadCancel& cancel = ReadCancel{},
+                 RateLimiter* pace = nullptr);
+
+    size_t size() const { return count; }
+    // Units the listing can be split at: kernel buffers on Linux, single
+    // entries elsewhere
+    size_t parts() const;
+    bool truncated() const { return is_truncated; }
+    int last_error() const { return error; }
+    // Directory fd, kept open for *at() calls on the entries
+    int fd() const { return dir_fd; }
+    // Hand the fd over to the caller, who closes it
+    int release_fd() {
+        int fd = dir_fd;
+        dir_fd = -1;
+        return fd;
+    }
+
+    template<class F>
+    void for_each(F&& f) const { for_each_in(0, parts(), f); }
+    // Entries of parts [first, last) only
+    template<class F>
+    void for_each_in(size_t first, size_t last, F&& f) const;
+};
+
+// Template implementation for DirListing
+inline size_t DirListing::parts() const {
+#ifdef __linux__
+    return blocks.size();
+#else
+    return names.size();
+#endif
+}
+
+template<class F>
+void DirListing::for_each_in(size_t first, size_t last, F&& f) const {
+#ifdef __linux__
+    for (size_t b = first; b < last; ++b) {
+        const Block& block = blocks[b];
+        size_t pos = 0;
+        while (pos < block.used) {
+            const char* rec = block.data.get() + pos;
+            uint64_t inode;
+            unsigned short reclen;
+            std::memcpy(&inode, rec, sizeof(inode));
+            std::memcpy(&reclen, rec + 16, sizeof(reclen));
+            const char* name = rec + 19;
+            unsigned char d_type = static_cast<unsigned char>(rec[18]);
+            pos += reclen;
+
+            if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) {
+                continue;
+            }
+
+            DirEntryType type;
+            switch (d_type) {
+                case DT_REG: type = DirEntryType::Regular; break;
+                case DT_DIR: type = DirEntryType::Directory; break;
+                case DT_LNK: type = DirEntryType::Symlink; break;
+                case DT_UNKNOWN: type = DirEntryType::Unknown; break;
+                default: type = DirEntryType::Other; break;
+            }
+            f(DirRecord{name, inode, type});
+        }
+    }
+#else
+    for (size_t i = first; i < last; ++i) {
+        f(DirRecord{names[i].c_str(), 0, types[i]});
+    }
+#endif
+}
+
+#endif // DUA_FS_H
@@ -0,0 +1,396 @@
+// dua_snapshot.cpp - Saving and reloading scanned trees
+#include "dua_snapshot.h"
+#include "dua_core.h"
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+
+static uint64_t align_up(uint64_t value, uint64_t alignment) {
+    return (value + alignment - 1) & ~(alignment - 1);
+}
+
+static bool write_all(int fd, const void* data, size_t size, uint64_t offset) {
+    const char* p = static_cast<const char*>(data);
+    while (size > 0) {
+        ssize_t n = pwrite(fd, p, size, static_cast<off_t>(offset));
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        p += n;
+        size -= static_cast<size_t>(n);
+        offset += static_cast<uint64_t>(n);
+    }
+    return true;
+}
+
+// Whether ref names a whole, NUL-terminated record within one chunk of a
+// string table of size bytes
+static bool valid_string(const char* table, uint64_t size, uint32_t ref) {
+    uint16_t len;
+    if (uint64_t{ref} + sizeof(len) > size) return false;
+    std::memcpy(&len, table + ref, sizeof(len));
+    uint64_t end = uint64_t{ref} + sizeof(len) + len + 1;
+    return end <= size && 
+           (ref & (NodeStore::STRING_CHUNK_SIZE - 1)) + sizeof(len) + len + 1 <= 
+               NodeStore::STRING_CHUNK_SIZE &&
+           table[end - 1] == '\0';
+}
+
+namespace {
+
+// String table built the way the store's arena lays it out: records never
+// straddle a chunk, so a reference is just the offset into the table
+class StringPacker {
+private:
+    std::vector<char> table;
+    std::unordered_map<std::string_view, uint32_t> names;   // Views into the store
+
+public:
+    bool full = false;
+
+    uint32_t add(std::string_view text) {
+        uint16_t len = static_cast<uint16_t>(std::min<size_t>(text.size(), UINT16_MAX));
+        uint32_t record = sizeof(len) + len + 1;
+
+        size_t pos = table.size();
+        if ((pos & (NodeStore::STRING_CHUNK_SIZE - 1)) + record > NodeStore::STRING_CHUNK_SIZE) {
+            pos = align_up(pos, NodeStore::STRING_CHUNK_SIZE);
+        }
+        if (pos + record > UINT32_MAX) {
+            full = true;
+            return 0;
+        }
+
+        table.resize(pos + record);
+        std::memcpy(table.data() + pos, &len, sizeof(len));
+        std::memcpy(table.data() + pos + sizeof(len), text.data(), len);
+        table[pos + sizeof(len) + len] = '\0';
+        return static_cast<uint32_t>(pos);
+    }
+
+    uint32_t add_name(std::string_view text) {
+        auto it = names.find(text);
+        if (it != names.end()) {
+            return it->second;
+        }
+        uint32_t ref = add(text);
+        names.emplace(text, ref);
+        return ref;
+    }
+
+    const std::vector<char>& data() const { return table; }
+};
+
+}
+
+bool save_snapshot(const fs::path& file, const NodeStore& store,
+                   const std::vector<NodeId>& roots, const Config& config,
+                   int64_t created, std::string& error) {
+    // Count first so the node table can be written in place
+    size_t count = 0;
+    std::vector<NodeId> stack(roots.begin(), roots.end());
+    while (!stack.empty()) {
+        NodeId id = stack.back();
+        stack.pop_back();
+        count++;
+        if (!store[id].is_symlink()) {
+            store.for_each_child(id, [&](NodeId child) {
+                stack.push_back(child);
+            });
+        }
+    }
+    if (count >= INVALID_NODE) {
+        error = "too many entries for a snapshot";
+        return false;
+    }
+
+    SnapshotHeader header{};
+    std::memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = SNAPSHOT_VERSION;
+    header.node_size = sizeof(Node);
+    if (config.apparent_size) header.flags |= SNAPSHOT_APPARENT_SIZE;
+    if (config.count_hard_links) header.flags |= SNAPSHOT_COUNT_HARD_LINKS;
+    if (config.stay_on_filesystem) header.flags |= SNAPSHOT_STAY_ON_FILESYSTEM;
+    header.ignored_digest = ignored_dirs_digest(config);
+    header.root_count = static_cast<uint32_t>(roots.size());
+    header.node_count = static_cast<uint32_t>(count);
+    header.created = created;
+    header.roots_offset = sizeof(header);
+    header.nodes_offset = align_up(header.roots_offset + roots.size() * sizeof(NodeId),
+                                   SNAPSHOT_ALIGN);
+
+    fs::path temp = file;
+    temp += ".tmp";
+    int fd = open(temp.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        error = std::string("cannot create ") + temp.string() + ": " + std::strerror(errno);
+        return false;
+    }
+    auto fail = [&](const std::string& what) {
+        error = what + ": " + std::strerror(errno);
+        close(fd);
+        unlink(temp.c_str());
+        return false;
+    };
+
+    size_t nodes_size = count * sizeof(Node);
+    size_t mapped_size = header.nodes_offset + nodes_size;
+    if (ftruncate(fd, static_cast<off_t>(mapped_size)) != 0) {
+        return fail("cannot size snapshot");
+    }
+    void* base = nullptr;
+    if (nodes_size > 0) {
+        base = mmap(nullptr, mapped_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (base == MAP_FAILED) {
+            return fail("cannot map snapshot");
+        }
+    }
+    Node* out = reinterpret_cast<Node*>(static_cast<char*>(base) + header.nodes_offset);
+
+    // Depth-first renumbering: new ids are handed out in visit order, and a
+    // node is linked behind the last child its parent got so far
+    StringPacker strings;
+    std::vector<SnapshotLink> links;
+    std::vector<NodeStamp> stamps;
+    std::vector<NodeId> root_ids;
+    std::vector<NodeId> last_child(count, INVALID_NODE);
+    std::vector<std::pair<NodeId, NodeId>> pending;     // (old id, new parent)
+    std::vector<NodeId> children;
+    NodeId next_id = 0;
+
+    for (NodeId root : roots) {
+        pending.emplace_back(root, INVALID_NODE);
+
+        while (!pending.empty()) {
+            auto [old_id, parent] = pending.back();
+            pending.pop_back();
+
+            NodeId id = next_id++;
+            Node node = store[old_id];
+            node.parent = parent;
+            node.first_child = INVALID_NODE;
+            node.next_sibling = INVALID_NODE;
+            node.name = strings.add_name(store.name(old_id));
+            node.flags &= ~(NODE_MARKED | NODE_VIRTUAL);
+            out[id] = node;
+
+            if (parent == INVALID_NODE) {
+                root_ids.push_back(id);
+            } else if (last_child[parent] == INVALID_NODE) {
+                out[parent].first_child = id;
+            } else {
+                out[last_child[parent]].next_sibling = id;
+            }
+            if (parent != INVALID_NODE) {
+                last_child[parent] = id;
+            }
+
+            if (node.is_symlink()) {
+                links.push_back({id, strings.add(store.symlink_target(old_id))});
+                continue;
+            }
+            DirStamp stamp;
+            if (node.is_directory() && store.find_stamp(old_id, stamp)) {
+                stamps.push_back({id, 0, stamp});
+            }
+
+            children.clear();
+            store.for_each_child(old_id, [&](NodeId child) {
+                children.push_back(child);
+            });
+            for (size_t i = children.size(); i-- > 0;) {
+                pending.emplace_back(children[i], id);
+            }
+        }
+    }
+
+    if (base && munmap(base, mapped_size) != 0) {
+        return fail("cannot write snapshot nodes");
+    }
+    if (strings.full) {
+        errno = EFBIG;
+        return fail("string table too large");
+    }
+
+    header.strings_offset = align_up(mapped_size, SNAPSHOT_ALIGN);
+    header.strings_size = strings.data().size();
+    header.links_offset = align_up(header.strings_offset + header.strings_size,
+                                   alignof(SnapshotLink));
+    header.link_count = static_cast<uint32_t>(links.size());
+    header.stamps_offset = align_up(header.links_offset + links.size() * sizeof(SnapshotLink),
+                                    alignof(NodeStamp));
+    header.stamp_count = static_cast<uint32_t>(stamps.size());
+    header.file_size = header.stamps_offset + stamps.size() * sizeof(NodeStamp);
+
+    if (!write_all(fd, root_ids.data(), root_ids.size() * sizeof(NodeId), header.roots_offset) ||
+        !write_all(fd, strings.data().data(), strings.data().size(), header.strings_offset) ||
+        !write_all(fd, links.data(), links.size() * sizeof(SnapshotLink), header.links_offset) ||
+        !write_all(fd, stamps.data(), stamps.size() * sizeof(NodeStamp), header.stamps_offset) ||
+        ftruncate(fd, static_cast<off_t>(header.file_size)) != 0 ||
+        !write_all(fd, &header, sizeof(header), 0)) {
+        return fail("cannot write snapshot");
+    }
+
+    if (close(fd) != 0) {
+        unlink(temp.c_str());
+        error = std::string("cannot write snapshot: ") + std::strerror(errno);
+        return false;
+    }
+    std::error_code ec;
+    fs::rename(temp, file, ec);
+    if (ec) {
+        unlink(temp.c_str());
+        error = "cannot replace " + file.string() + ": " + ec.message();
+        return false;
+    }
+    return true;
+}
+
+bool load_snapshot(const fs::path& file, NodeStore& store, std::vector<NodeId>& roots,
+                   SnapshotInfo& info, std::string& error) {
+    int fd = open(file.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        error = std::string("cannot open ") + file.string() + ": " + std::strerror(errno);
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(SnapshotHeader)) {
+        close(fd);
+        error = file.string() + " is not a snapshot";
+        return false;
+    }
+
+    // Private and writable: the UI marks and edits nodes in place, and
+    // those changes must never reach the file
+    size_t size = static_cast<size_t>(st.st_size);
+    void* base = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        error = std::string("cannot map ") + file.string() + ": " + std::strerror(errno);
+        return false;
+    }
+    std::shared_ptr<void> mapping(base, [size](void* p) { munmap(p, size); });
+
+    const char* bytes = static_cast<const char*>(base);
+    SnapshotHeader header;
+    std::memcpy(&header, bytes, sizeof(header));
+
+    if (std::memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) != 0) {
+        error = file.string() + " is not a snapshot";
+        return false;
+    }
+    if (header.version != SNAPSHOT_VERSION || header.node_size != sizeof(Node)) {
+        error = file.string() + " was written by an incompatible version (format " +
+                std::to_string(header.version) + ")";
+        return false;
+    }
+
+    auto fits = [size](uint64_t offset, uint64_t length) {
+        return offset <= size && length <= size - offset;
+    };
+    if (header.file_size != size ||
+        header.nodes_offset % SNAPSHOT_ALIGN != 0 ||
+        header.strings_offset % SNAPSHOT_ALIGN != 0 ||
+        header.links_offset % alignof(SnapshotLink) != 0 ||
+        header.stamps_offset % alignof(NodeStamp) != 0 ||
+        !fits(header.roots_offset, uint64_t{header.root_count} * sizeof(NodeId)) ||
+        !fits(header.nodes_offset, uint64_t{header.node_count} * sizeof(Node)) ||
+        !fits(header.strings_offset, header.strings_size) ||
+        !fits(header.links_offset, uint64_t{header.link_count} * sizeof(SnapshotLink)) ||
+        !fits(header.stamps_offset, uint64_t{header.stamp_count} * sizeof(NodeStamp))) {
+        error = file.string() + " is truncated or corrupt";
+        return false;
+    }
+
+    roots.resize(header.root_count);
+    std::memcpy(roots.data(), bytes + header.roots_offset, roots.size() * sizeof(NodeId));
+    for (NodeId root : roots) {
+        if (root >= header.node_count) {
+            error = file.string() + " is truncated or corrupt";
+            return false;
+        }
+    }
+
+    // The store follows every id and string reference as it stands, so a
+    // damaged file has to be caught here rather than crash it later.
+    // Nodes are numbered depth first: parents come before their children
+    // and each child before its next sibling, which also rules out loops.
+    char* data = static_cast<char*>(base);
+    const char* string_table = data + header.strings_offset;
+    const Node* nodes = reinterpret_cast<const Node*>(data + header.nodes_offset);
+    auto corrupt = [&]() {
+        error = file.string() + " is truncated or corrupt";
+        return false;
+    };
+    for (NodeId id = 0; id < header.node_count; ++id) {
+        const Node& node = nodes[id];
+        if ((node.parent != INVALID_NODE && node.parent >= id) ||
+            (node.first_child != INVALID_NODE && 
+             (node.first_child <= id || node.first_child >= header.node_count)) ||
+            (node.next_sibling != INVALID_NODE && 
+             (node.next_sibling <= id || node.next_sibling >= header.node_count)) ||
+            (node.flags & NODE_VIRTUAL) ||
+            !valid_string(string_table, header.strings_size, node.name)) {
+            return corrupt();
+        }
+    }
+
+    std::vector<std::pair<NodeId, uint32_t>> links(header.link_count);
+    const char* link_table = bytes + header.links_offset;
+    for (uint32_t i = 0; i < header.link_count; ++i) {
+        SnapshotLink link;
+        std::memcpy(&link, link_table + i * sizeof(SnapshotLink), sizeof(link));
+        if (link.node >= header.node_count ||
+            !valid_string(string_table, header.strings_size, link.target)) {
+            return corrupt();
+        }
+        links[i] = {link.node, link.target};
+    }
+
+    // Looked up by binary search, so they must stay in node order
+    const NodeStamp* stamps = reinterpret_cast<const NodeStamp*>(data + header.stamps_offset);
+    for (uint32_t i = 0; i < header.stamp_count; ++i) {
+        if (stamps[i].node >= header.node_count || (i > 0 && stamps[i].node <= stamps[i - 1].node)) {
+            return corrupt();
+        }
+    }
+
+    try {
+        store.attach(mapping, reinterpret_cast<Node*>(data + header.nodes_offset),
+                     header.node_count, data + header.strings_offset, header.strings_size,
+                     links, stamps, header.stamp_count);
+    } catch (const std::exception& e) {
+        error = e.what();
+        return false;
+    }
+
+    info.version = header.version;
+    info.flags = header.flags;
+    info.ignored_digest = header.ignored_digest;
+    info.created = header.created;
+    info.node_count = header.node_count;
+    info.stamp_count = header.stamp_count;
+    info.file_size = size;
+    return true;
+}
+
+uint32_t ignored_dirs_digest(const Config& config) {
+    if (config.ignore_dirs.empty()) return 0;
+    // FNV-1a over the canonical paths in order, folded to 32 bits
+    uint64_t hash = 1469598103934665603ULL;
+    for (const auto& dir : config.ignore_dirs) {
+        for (char c : dir.native()) {
+            hash = (hash ^ static_cast<unsigned char>(c)) * 1099511628211ULL;
+        }
+        hash = hash * 1099511628211ULL;
+    }
+    return static_cast<uint32_t>(hash ^ (hash >> 32)) | 1;
+}
+
+void apply_snapshot_flags(const SnapshotInfo& info, Config& config) {
+    config.apparent_size = info.flags & SNAPSHOT_APPARENT_SIZE;
+    config.count_hard_links = info.flags & SNAPSHOT_COUNT_HARD_LINKS;
+    config.stay_on_filesystem = info.flags & SNAPSHOT_STAY_ON_FILESYSTEM;
+}
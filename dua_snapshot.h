@@ -0,0 +1,79 @@
+// dua_snapshot.h - Saving and reloading scanned trees
+#ifndef DUA_SNAPSHOT_H
+#define DUA_SNAPSHOT_H
+
+#include "dua_tree.h"
+#include <string>
+#include <vector>
+#include <cstdint>
+
+struct Config;
+
+// File layout: header and root ids, then the node table and the string
+// table, each starting on a page boundary, then symlink targets and
+// directory timestamps (ordered by node, for incremental rescans). Nodes
+// are numbered densely in depth-first order and strings are packed into
+// arena-sized chunks, so a loaded store points straight into the mapping.
+constexpr char SNAPSHOT_MAGIC[8] = {'D', 'U', 'A', 'S', 'N', 'A', 'P', '\0'};
+constexpr uint32_t SNAPSHOT_VERSION = 4;   // 3: NODE_HARDLINK, 4: ignored_digest
+constexpr uint64_t SNAPSHOT_ALIGN = 4096;
+
+// Scan options the recorded sizes depend on
+enum SnapshotFlags : uint32_t {
+    SNAPSHOT_APPARENT_SIZE      = 1u << 0,
+    SNAPSHOT_COUNT_HARD_LINKS   = 1u << 1,
+    SNAPSHOT_STAY_ON_FILESYSTEM = 1u << 2
+};
+
+struct SnapshotHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t node_size;         // sizeof(Node) of the writer
+    uint32_t flags;
+    uint32_t root_count;
+    uint32_t node_count;
+    uint32_t link_count;
+    uint32_t stamp_count;
+    uint32_t ignored_digest;    // ignored_dirs_digest of the scan
+    int64_t created;            // When the scan started, seconds since the epoch
+    uint64_t roots_offset;
+    uint64_t nodes_offset;
+    uint64_t strings_offset;
+    uint64_t strings_size;
+    uint64_t links_offset;
+    uint64_t stamps_offset;
+    uint64_t file_size;
+};
+
+struct SnapshotLink {
+    NodeId node;
+    uint32_t target;            // String table reference
+};
+
+struct SnapshotInfo {
+    uint32_t version = 0;
+    uint32_t flags = 0;
+    uint32_t ignored_digest = 0;
+    int64_t created = 0;
+    size_t node_count = 0;
+    size_t stamp_count = 0;
+    size_t file_size = 0;
+};
+
+// Write the trees under roots to file (through a temporary and a rename)
+bool save_snapshot(const fs::path& file, const NodeStore& store,
+                   const std::vector<NodeId>& roots, const Config& config,
+                   int64_t created, std::string& error);
+
+// Replace the contents of store with a snapshot; roots receives its roots.
+// Nothing is copied: the store serves nodes from a private mapping.
+bool load_snapshot(const fs::path& file, NodeStore& store, std::vector<NodeId>& roots,
+                   SnapshotInfo& info, std::string& error);
+
+// Fingerprint of the --ignore-dirs set, 0 when nothing is ignored
+uint32_t ignored_dirs_digest(const Config& config);
+
+// Adopt the scan options a snapshot was taken with
+void apply_snapshot_flags(const SnapshotInfo& info, Config& config);
+
+#endif // DUA_SNAPSHOT_H
@@ -0,0 +1,518 @@
+// dua_tree.cpp - Compact node storage implementation
+#include "dua_tree.h"
+#include <algorithm>
+#include <stdexcept>
+#include <cstring>
+
+// NodeStore implementation
+NodeStore::NodeStore(size_t workers) : lane_count(workers + 1) {
+    node_chunks = std::make_unique<Node*[]>(MAX_NODE_CHUNKS);
+    string_chunks = std::make_unique<char*[]>(MAX_STRING_CHUNKS);
+    lanes = std::make_unique<Lane[]>(lane_count);
+    intern_table = std::make_unique<std::atomic<uint64_t>[]>(INTERN_SLOTS);
+    for (uint32_t i = 0; i < INTERN_SLOTS; ++i) {
+        intern_table[i].store(0, std::memory_order_relaxed);
+    }
+}
+
+NodeStore::Lane& NodeStore::lane_for(size_t worker) {
+    return lanes[std::min(worker, lane_count - 1)];
+}
+
+uint32_t NodeStore::store_string(Lane& lane, std::string_view text) {
+    uint16_t len = static_cast<uint16_t>(std::min<size_t>(text.size(), UINT16_MAX));
+    uint32_t record = sizeof(len) + len + 1;
+
+    if (lane.string_pos + record > STRING_CHUNK_SIZE) {
+        std::lock_guard<std::mutex> lock(chunk_mutex);
+        if (string_chunk_count == MAX_STRING_CHUNKS) {
+            throw std::length_error("string arena exhausted");
+        }
+        owned_string_chunks.emplace_back(new char[STRING_CHUNK_SIZE]);
+        string_chunks[string_chunk_count] = owned_string_chunks.back().get();
+        lane.string_chunk = string_chunk_count++;
+        lane.string_pos = 0;
+    }
+
+    char* p = string_chunks[lane.string_chunk] + lane.string_pos;
+    std::memcpy(p, &len, sizeof(len));
+    std::memcpy(p + sizeof(len), text.data(), len);
+    p[sizeof(len) + len] = '\0';
+
+    uint32_t ref = (lane.string_chunk << STRING_CHUNK_BITS) | lane.string_pos;
+    lane.string_pos += record;
+    lane.string_bytes += record;
+    return ref;
+}
+
+uint32_t NodeStore::intern(Lane& lane, std::string_view text) {
+    // FNV-1a; the low bits pick the slot, the high bits tag it (never 0)
+    uint64_t hash = 1469598103934665603ULL;
+    for (char c : text) {
+        hash = (hash ^ static_cast<unsigned char>(c)) * 1099511628211ULL;
+    }
+    uint64_t tag = (hash >> 32) | 1;
+    auto& slot = intern_table[hash & (INTERN_SLOTS - 1)];
+
+    uint64_t cached = slot.load(std::memory_order_acquire);
+    if ((cached >> 32) == tag) {
+        uint32_t ref = static_cast<uint32_t>(cached);
+        if (string_at(ref) == text) {
+            lane.shared_names++;
+            return ref;
+        }
+    }
+
+    uint32_t ref = store_string(lane, text);
+    slot.store((tag << 32) | ref, std::memory_order_release);
+    return ref;
+}
+
+std::string_view NodeStore::string_at(uint32_t ref) const {
+    const char* p = string_chunks[ref >> STRING_CHUNK_BITS] + (ref & (STRING_CHUNK_SIZE - 1));
+    uint16_t len;
+    std::memcpy(&len, p, sizeof(len));
+    return std::string_view(p + sizeof(len), len);
+}
+
+NodeId NodeStore::create(size_t worker, NodeId parent, std::string_view name, uint32_t flags,
+                         ChildChain* chain) {
+    Lane& lane = lane_for(worker);
+    std::lock_guard<std::mutex> lock(lane.mutex);
+
+    if (lane.next_node == lane.node_end) {
+        std::lock_guard<std::mutex> chunk_lock(chunk_mutex);
+        // The last chunk is never handed out so INVALID_NODE stays unused
+        if (node_chunk_count == MAX_NODE_CHUNKS - 1) {
+            throw std::length_error("node store exhausted");
+        }
+        owned_node_chunks.emplace_back(new Node[NODES_PER_CHUNK]);
+        node_chunks[node_chunk_count] = owned_node_chunks.back().get();
+        lane.next_node = node_chunk_count << NODE_CHUNK_BITS;
+        lane.node_end = lane.next_node + NODES_PER_CHUNK;
+        node_chunk_count++;
+    }
+
+    NodeId id = lane.next_node++;
+    lane.nodes++;
+
+    Node& node = (*this)[id];
+    node = Node{};
+    node.name = (flags & (NODE_ROOT | NODE_VIRTUAL)) ? store_string(lane, name) 
+                                                     : intern(lane, name);
+    node.flags = flags;
+    node.parent = parent;
+    node.first_child = INVALID_NODE;
+    node.next_sibling = INVALID_NODE;
+
+    if (chain) {
+        node.next_sibling = chain->head;
+        chain->head = id;
+        if (chain->tail == INVALID_NODE) {
+            chain->tail = id;
+        }
+    } else if (parent != INVALID_NODE) {
+        Node& p = (*this)[parent];
+        node.next_sibling = p.first_child;
+        p.first_child = id;
+    }
+    return id;
+}
+
+void NodeStore::splice_children(NodeId parent, const ChildChain& chain) {
+    if (chain.head == INVALID_NODE) return;
+    Node& p = (*this)[parent];
+    (*this)[chain.tail].next_sibling = p.first_child;
+    p.first_child = chain.head;
+}
+
+NodeId NodeStore::make_virtual(std::string_view name, const std::vector<NodeId>& members) {
+    NodeId id = create(SIZE_MAX, INVALID_NODE, name, NODE_VIRTUAL | NODE_DIRECTORY);
+    Node& node = (*this)[id];
+
+    for (NodeId member : members) {
+        const Node& m = (*this)[member];
+        node.size += m.size;
+        node.entry_count += m.entry_count;
+        if (m.is_incomplete()) {
+            node.flags |= NODE_INCOMPLETE;
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(side_mutex);
+    node.first_child = static_cast<NodeId>(virtual_members.size());
+    virtual_members.push_back(members);
+    return id;
+}
+
+void NodeStore::clear() {
+    std::lock_guard<std::mutex> chunk_lock(chunk_mutex);
+    std::lock_guard<std::mutex> side_lock(side_mutex);
+
+    owned_node_chunks.clear();
+    owned_string_chunks.clear();
+    std::fill(node_chunks.get(), node_chunks.get() + node_chunk_count, nullptr);
+    std::fill(string_chunks.get(), string_chunks.get() + string_chunk_count, nullptr);
+    node_chunk_count = 0;
+    string_chunk_count = 0;
+
+    for (size_t i = 0; i < lane_count; ++i) {
+        Lane& lane = lanes[i];
+        lane.next_node = 0;
+        lane.node_end = 0;
+        lane.string_chunk = 0;
+        lane.string_pos = STRING_CHUNK_SIZE;
+        lane.nodes = 0;
+        lane.string_bytes = 0;
+        lane.shared_names = 0;
+        lane.stamps.clear();
+    }
+    for (uint32_t i = 0; i < INTERN_SLOTS; ++i) {
+        intern_table[i].store(0, std::memory_order_relaxed);
+    }
+
+    virtual_members.clear();
+    link_targets.clear();
+    late_stamps.clear();
+    mapping.reset();
+    mapped_nodes = 0;
+    mapped_string_bytes = 0;
+    mapped_stamps = nullptr;
+    mapped_stamp_count = 0;
+}
+
+void NodeStore::attach(std::shared_ptr<void> keep_alive, Node* nodes, uint32_t count,
+                       char* strings, size_t string_size,
+                       const std::vector<std::pair<NodeId, uint32_t>>& links,
+                       const NodeStamp* stamps, size_t stamp_count) {
+    clear();
+    
+    uint32_t node_chunks_used = (count + NODES_PER_CHUNK - 1) / NODES_PER_CHUNK;
+    size_t string_chunks_used = (string_size + STRING_CHUNK_SIZE - 1) / STRING_CHUNK_SIZE;
+    if (node_chunks_used > MAX_NODE_CHUNKS - 1 || string_chunks_used > MAX_STRING_CHUNKS) {
+        throw std::length_error("snapshot too large for the node store");
+    }
+    
+    std::lock_guard<std::mutex> chunk_lock(chunk_mutex);
+    std::lock_guard<std::mutex> side_lock(side_mutex);
+    
+    for (uint32_t i = 0; i < node_chunks_used; ++i) {
+        node_chunks[i] = nodes + static_cast<size_t>(i) * NODES_PER_CHUNK;
+    }
+    for (size_t i = 0; i < string_chunks_used; ++i) {
+        string_chunks[i] = strings + i * STRING_CHUNK_SIZE;
+    }
+    node_chunk_count = node_chunks_used;
+    string_chunk_count = static_cast<uint32_t>(string_chunks_used);
+    
+    link_targets.reserve(links.size());
+    for (const auto& [id, ref] : links) {
+        link_targets.emplace(id, ref);
+    }
+    
+    mapping = std::move(keep_alive);
+    mapped_nodes = count;
+    mapped_string_bytes = string_size;
+    mapped_stamps = stamps;
+    mapped_stamp_count = stamp_count;
+}
+
+std::string NodeStore::display_name(NodeId id) const {
+    std::string_view raw = name(id);
+    if (!((*this)[id].flags & NODE_ROOT)) {
+        return std::string(raw);
+    }
+
+    std::string file = fs::path(raw).filename().string();
+    return file.empty() ? std::string(raw) : file;
+}
+
+fs::path NodeStore::path(NodeId id) const {
+    // Walk up to the root collecting names, then join them top-down into
+    // a single preallocated string
+    thread_local std::vector<std::string_view> parts;
+    parts.clear();
+    size_t length = 0;
+
+    for (NodeId current = id; current != INVALID_NODE;) {
+        const Node& node = (*this)[current];
+        parts.push_back(string_at(node.name));
+        length += parts.back().size() + 1;
+        if (node.flags & (NODE_ROOT | NODE_VIRTUAL)) break;
+        current = node.parent;
+    }
+
+    std::string result;
+    result.reserve(length);
+    for (size_t i = parts.size(); i-- > 0;) {
+        if (!result.empty() && result.back() != '/') {
+            result += '/';
+        }
+        result.append(parts[i].data(), parts[i].size());
+    }
+    return fs::path(std::move(result));
+}
+
+void NodeStore::set_symlink_target(size_t worker, NodeId id, std::string_view target) {
+    uint32_t ref;
+    {
+        Lane& lane = lane_for(worker);
+        std::lock_guard<std::mutex> lock(lane.mutex);
+        ref = store_string(lane, target);
+    }
+
+    std::lock_guard<std::mutex> lock(side_mutex);
+    link_targets[id] = ref;
+}
+
+std::string NodeStore::symlink_target(NodeId id) const {
+    std::lock_guard<std::mutex> lock(side_mutex);
+    auto it = link_targets.find(id);
+    if (it == link_targets.end()) {
+        return "[unreadable]";
+    }
+    return std::string(string_at(it->second));
+}
+
+void NodeStore::set_stamp(size_t worker, NodeId id, const DirStamp& stamp) {
+    Lane& lane = lane_for(worker);
+    std::lock_guard<std::mutex> lock(lane.mutex);
+    lane.stamps.push_back({id, 0, stamp});
+}
+
+void NodeStore::set_late_stamp(NodeId id, const DirStamp& stamp) {
+    std::lock_guard<std::mutex> lock(side_mutex);
+    late_stamps[id] = stamp;
+}
+
+bool NodeStore::find_stamp(NodeId id, DirStamp& out) const {
+    auto search = [&](const NodeStamp* begin, const NodeStamp* end) {
+        const NodeStamp* it = std::lower_bound(begin, end, id,
+            [](const NodeStamp& entry, NodeId key) { return entry.node < key; });
+        if (it != end && it->node == id) {
+            out = it->stamp;
+            return true;
+        }
+        return false;
+    };
+    
+    if (search(mapped_stamps, mapped_stamps + mapped_stamp_count)) {
+        return true;
+    }
+    for (size_t i = 0; i < lane_count; ++i) {
+        std::lock_guard<std::mutex> lock(lanes[i].mutex);
+        const auto& stamps = lanes[i].stamps;
+        if (search(stamps.data(), stamps.data() + stamps.size())) {
+            return true;
+        }
+    }
+    
+    std::lock_guard<std::mutex> lock(side_mutex);
+    auto it = late_stamps.find(id);
+    if (it == late_stamps.end()) {
+        return false;
+    }
+    out = it->second;
+    return true;
+}
+
+bool NodeStore::has_children(NodeId id) const {
+    const Node& node = (*this)[id];
+    if (node.flags & NODE_VIRTUAL) {
+        std::lock_guard<std::mutex> lock(side_mutex);
+        return !virtual_members[node.first_child].empty();
+    }
+    return node.first_child != INVALID_NODE;
+}
+
+std::vector<NodeId> NodeStore::children(NodeId id) const {
+    std::vector<NodeId> result;
+    for_each_child(id, [&](NodeId child) {
+        result.push_back(child);
+    });
+    return result;
+}
+
+void NodeStore::set_children(NodeId id, const std::vector<NodeId>& ordered) {
+    Node& node = (*this)[id];
+    if (node.flags & NODE_VIRTUAL) {
+        std::lock_guard<std::mutex> lock(side_mutex);
+        virtual_members[node.first_child] = ordered;
+        return;
+    }
+
+    NodeId next = INVALID_NODE;
+    for (size_t i = ordered.size(); i-- > 0;) {
+        Node& child = (*this)[ordered[i]];
+        child.parent = id;
+        child.next_sibling = next;
+        next = ordered[i];
+    }
+    node.first_child = next;
+}
+
+void NodeStore::unlink_child(NodeId parent, NodeId child) {
+    Node& node = (*this)[parent];
+    Node& entry = (*this)[child];
+    if (node.first_child == child) {
+        node.first_child = entry.next_sibling;
+    } else {
+        for (NodeId prev = node.first_child; prev != INVALID_NODE; prev = (*this)[prev].next_sibling) {
+            if ((*this)[prev].next_sibling == child) {
+                (*this)[prev].next_sibling = entry.next_sibling;
+                break;
+            }
+        }
+    }
+    entry.parent = INVALID_NODE;
+    entry.next_sibling = INVALID_NODE;
+}
+
+bool NodeStore::attached(NodeId id) const {
+    // Unlinked subtrees end in a parentless node that is not a root
+    for (;;) {
+        const Node& node = (*this)[id];
+        if (node.flags & (NODE_ROOT | NODE_VIRTUAL)) return true;
+        if (node.parent == INVALID_NODE) return false;
+        id = node.parent;
+    }
+}
+
+void NodeStore::apply_delta(NodeId id, int64_t size_delta, int64_t count_delta) {
+    for (; id != INVALID_NODE; id = (*this)[id].parent) {
+        Node& node = (*this)[id];
+        int64_t entries = static_cast<int64_t>(node.entry_count) + count_delta;
+        node.entry_count = static_cast<uint32_t>(std::max<int64_t>(entries, 0));
+        if (size_delta < 0 && node.size < static_cast<uint64_t>(-size_delta)) {
+            node.size = 0;
+        } else {
+            node.size += static_cast<uint64_t>(size_delta);
+        }
+    }
+}
+
+size_t NodeStore::node_count() const {
+    size_t total = mapped_nodes;
+    for (size_t i = 0; i < lane_count; ++i) {
+        std::lock_guard<std::mutex> lock(lanes[i].mutex);
+        total += lanes[i].nodes;
+    }
+    return total;
+}
+
+size_t NodeStore::node_bytes() const {
+    return node_count() * sizeof(Node);
+}
+
+size_t NodeStore::shared_name_count() const {
+    size_t total = 0;
+    for (size_t i = 0; i < lane_count; ++i) {
+        std::lock_guard<std::mutex> lock(lanes[i].mutex);
+        total += lanes[i].shared_names;
+    }
+    return total;
+}
+
+size_t NodeStore::string_bytes() const {
+    size_t total = mapped_string_bytes;
+    for (size_t i = 0; i < lane_count; ++i) {
+        std::lock_guard<std::mutex> lock(lanes[i].mutex);
+        total += lanes[i].string_bytes;
+    }
+    return total;
+}
+
+namespace {
+
+template<class Less>
+void select_sorted(std::vector<NodeId>& ids, size_t limit, Less less) {
+    if (limit > 0 && limit < ids.size()) {
+        std::partial_sort(ids.begin(), ids.begin() + limit, ids.end(), less);
+    } else {
+        std::sort(ids.begin(), ids.end(), less);
+    }
+}
+
+}
+
+void order_children(const NodeStore& store, std::vector<NodeId>& ids, SortMode mode,
+                    size_t limit) {
+    switch (mode) {
+        case SortMode::SIZE_DESC:
+            select_sorted(ids, limit, [&store](NodeId a, NodeId b) {
+                return store[a].size > store[b].size;
+            });
+            break;
+        case SortMode::SIZE_ASC:
+            select_sorted(ids, limit, [&store](NodeId a, NodeId b) {
+                return store[a].size < store[b].size;
+            });
+            break;
+        case SortMode::NAME_ASC:
+            select_sorted(ids, limit, [&store](NodeId a, NodeId b) {
+                return store.name(a) < store.name(b);
+            });
+            break;
+        case SortMode::NAME_DESC:
+            select_sorted(ids, limit, [&store](NodeId a, NodeId b) {
+                return store.name(a) > store.name(b);
+            });
+            break;
+        case SortMode::TIME_DESC:
+            select_sorted(ids, limit, [&store](NodeId a, NodeId b) {
+                return store[a].mtime > store[b].mtime;
+            });
+            break;
+        case SortMode::TIME_ASC:
+            select_sorted(ids, limit, [&store](NodeId a, NodeId b) {
+                return store[a].mtime < store[b].mtime;
+            });
+            break;
+        case SortMode::COUNT_DESC:
+            select_sorted(ids, limit, [&store](NodeId a, NodeId b) {
+                return store[a].entry_count > store[b].entry_count;
+            });
+            break;
+        case SortMode::COUNT_ASC:
+            select_sorted(ids, limit, [&store](NodeId a, NodeId b) {
+                return store[a].entry_count < store[b].entry_count;
+            });
+            break;
+    }
+}
+
+// ChildOrderCache implementation
+const std::vector<NodeId>& ChildOrderCache::get(NodeId dir, SortMode mode, size_t limit) {
+    uint64_t key = (static_cast<uint64_t>(dir) << 8) | static_cast<uint8_t>(mode);
+    auto [it, inserted] = orderings.try_emplace(key);
+    Ordering& ordering = it->second;
+    
+    if (inserted) {
+        ordering.children = store.children(dir);
+    }
+    size_t wanted = (limit > 0) ? std::min(limit, ordering.children.size()) 
+                                : ordering.children.size();
+    if (inserted || ordering.sorted < wanted) {
+        order_children(store, ordering.children, mode, wanted);
+        ordering.sorted = wanted;
+    }
+    return ordering.children;
+}
+
+void ChildOrderCache::invalidate(NodeId dir) {
+    for (NodeId current = dir; current != INVALID_NODE; current = store[current].parent) {
+        for (uint64_t mode = 0; mode <= static_cast<uint8_t>(SortMode::COUNT_ASC); ++mode) {
+            orderings.erase((static_cast<uint64_t>(current) << 8) | mode);
+        }
+        if (store[current].flags & NODE_ROOT) break;
+    }
+    
+    // Grouping nodes hold members from anywhere in the tree
+    for (auto it = orderings.begin(); it != orderings.end();) {
+        if (store[static_cast<NodeId>(it->first >> 8)].flags & NODE_VIRTUAL) {
+            it = orderings.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
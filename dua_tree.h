@@ -0,0 +1,262 @@
+// dua_tree.h - Compact node storage for scanned trees
+#ifndef DUA_TREE_H
+#define DUA_TREE_H
+
+#include <filesystem>
+#include <vector>
+#include <string>
+#include <string_view>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <unordered_map>
+#include <cstdint>
+
+namespace fs = std::filesystem;
+
+using NodeId = uint32_t;
+constexpr NodeId INVALID_NODE = UINT32_MAX;
+
+// Node flags
+enum NodeFlags : uint32_t {
+    NODE_DIRECTORY  = 1u << 0,
+    NODE_SYMLINK    = 1u << 1,
+    NODE_ROOT       = 1u << 2,   // Scan root, name holds the path as given
+    NODE_VIRTUAL    = 1u << 3,   // Grouping node ([Total], search results)
+    NODE_MARKED     = 1u << 4,
+    NODE_INCOMPLETE = 1u << 5,   // Directory (or something below it) timed out
+    NODE_DUPLICATE  = 1u << 6,   // Hard link whose inode was counted elsewhere
+    NODE_HARDLINK   = 1u << 7    // Regular file with more than one link
+};
+
+// Sorting modes
+enum class SortMode : uint8_t {
+    SIZE_DESC,
+    SIZE_ASC,
+    NAME_ASC,
+    NAME_DESC,
+    TIME_DESC,
+    TIME_ASC,
+    COUNT_DESC,
+    COUNT_ASC
+};
+
+// Fixed-size tree node. Children form a singly linked sibling list; for
+// virtual nodes first_child indexes the store's member lists instead.
+struct Node {
+    uint64_t size;
+    int64_t mtime;          // Seconds since the epoch
+    uint32_t entry_count;   // Bounded by the 32-bit node id space
+    NodeId parent;
+    NodeId first_child;
+    NodeId next_sibling;
+    uint32_t name;          // Reference into the string arena
+    uint32_t flags;
+
+    bool is_directory() const { return flags & NODE_DIRECTORY; }
+    bool is_symlink() const { return flags & NODE_SYMLINK; }
+    bool is_marked() const { return flags & NODE_MARKED; }
+    bool is_incomplete() const { return flags & NODE_INCOMPLETE; }
+    void set_flag(uint32_t flag, bool on) { flags = on ? (flags | flag) : (flags & ~flag); }
+};
+static_assert(sizeof(Node) == 40, "Node should stay compact");
+
+// Directory timestamps, kept so a later scan can tell what changed
+struct DirStamp {
+    int64_t mtime_sec;
+    int64_t ctime_sec;
+    uint32_t mtime_nsec;
+    uint32_t ctime_nsec;
+    
+    bool operator==(const DirStamp& other) const {
+        return mtime_sec == other.mtime_sec && ctime_sec == other.ctime_sec &&
+               mtime_nsec == other.mtime_nsec && ctime_nsec == other.ctime_nsec;
+    }
+};
+
+struct NodeStamp {
+    NodeId node;
+    uint32_t reserved;
+    DirStamp stamp;
+};
+static_assert(sizeof(NodeStamp) == 32, "NodeStamp is part of the snapshot format");
+
+// Node and string storage. Nodes live in fixed-size chunks handed out to
+// per-thread lanes, so allocation never contends across workers and a
+// NodeId stays valid (and its node in place) for the life of the store.
+// Nodes only keep their own name; full paths are rebuilt from the parent
+// chain when something actually needs one.
+class NodeStore {
+public:
+    static constexpr uint32_t NODE_CHUNK_BITS = 16;
+    static constexpr uint32_t NODES_PER_CHUNK = 1u << NODE_CHUNK_BITS;
+    static constexpr uint32_t MAX_NODE_CHUNKS = 1u << (32 - NODE_CHUNK_BITS);
+    static constexpr uint32_t STRING_CHUNK_BITS = 20;
+    static constexpr uint32_t STRING_CHUNK_SIZE = 1u << STRING_CHUNK_BITS;
+    static constexpr uint32_t MAX_STRING_CHUNKS = 1u << (32 - STRING_CHUNK_BITS);
+    static constexpr uint32_t INTERN_SLOTS = 1u << 16;
+
+private:
+    struct alignas(64) Lane {
+        std::mutex mutex;
+        NodeId next_node = 0;
+        NodeId node_end = 0;
+        uint32_t string_chunk = 0;
+        uint32_t string_pos = STRING_CHUNK_SIZE;
+        size_t nodes = 0;
+        size_t string_bytes = 0;
+        size_t shared_names = 0;
+        std::vector<NodeStamp> stamps;  // Ordered by node, lane ids only grow
+    };
+
+    std::unique_ptr<Node*[]> node_chunks;
+    std::unique_ptr<char*[]> string_chunks;
+    std::vector<std::unique_ptr<Node[]>> owned_node_chunks;
+    std::vector<std::unique_ptr<char[]>> owned_string_chunks;
+    uint32_t node_chunk_count = 0;
+    uint32_t string_chunk_count = 0;
+    std::mutex chunk_mutex;
+
+    std::unique_ptr<Lane[]> lanes;
+    size_t lane_count;
+
+    // Direct-mapped cache of recent names: (hash tag << 32) | string ref.
+    // Repeated names (index.js, __init__.py, Makefile) share one record.
+    std::unique_ptr<std::atomic<uint64_t>[]> intern_table;
+
+    std::vector<std::vector<NodeId>> virtual_members;
+    std::unordered_map<NodeId, uint32_t> link_targets;
+    std::unordered_map<NodeId, DirStamp> late_stamps;   // Out of lane order
+    mutable std::mutex side_mutex;
+    
+    // Snapshot the leading chunks point into, if any
+    std::shared_ptr<void> mapping;
+    size_t mapped_nodes = 0;
+    size_t mapped_string_bytes = 0;
+    const NodeStamp* mapped_stamps = nullptr;   // Ordered by node
+    size_t mapped_stamp_count = 0;
+
+    Lane& lane_for(size_t worker);
+    uint32_t store_string(Lane& lane, std::string_view text);
+    uint32_t intern(Lane& lane, std::string_view text);
+
+public:
+    // One lane per pool worker plus a shared one for other threads
+    explicit NodeStore(size_t workers = 0);
+
+    // Children gathered apart from their parent's list, so several threads
+    // can build one directory's children and link them in at the end
+    struct ChildChain {
+        NodeId head = INVALID_NODE;
+        NodeId tail = INVALID_NODE;
+    };
+
+    // Create a node and link it as the newest child of parent, or onto
+    // chain if one is given. Only the thread scanning parent may add
+    // children to it directly.
+    NodeId create(size_t worker, NodeId parent, std::string_view name, uint32_t flags,
+                  ChildChain* chain = nullptr);
+    // Put a chain in front of parent's children; callers serialize splices
+    // into the same parent
+    void splice_children(NodeId parent, const ChildChain& chain);
+    // Grouping node listing existing nodes without re-parenting them
+    NodeId make_virtual(std::string_view name, const std::vector<NodeId>& members);
+    void clear();
+    // Replace the contents with nodes and strings laid out chunk after
+    // chunk in memory owned by keep_alive (a loaded snapshot). New nodes
+    // and strings still go to chunks of their own.
+    void attach(std::shared_ptr<void> keep_alive, Node* nodes, uint32_t count,
+                char* strings, size_t string_size,
+                const std::vector<std::pair<NodeId, uint32_t>>& links,
+                const NodeStamp* stamps, size_t stamp_count);
+
+    Node& operator[](NodeId id) {
+        return node_chunks[id >> NODE_CHUNK_BITS][id & (NODES_PER_CHUNK - 1)];
+    }
+    const Node& operator[](NodeId id) const {
+        return node_chunks[id >> NODE_CHUNK_BITS][id & (NODES_PER_CHUNK - 1)];
+    }
+
+    std::string_view string_at(uint32_t ref) const;
+    std::string_view name(NodeId id) const { return string_at((*this)[id].name); }
+    std::string display_name(NodeId id) const;
+    fs::path path(NodeId id) const;
+
+    void set_symlink_target(size_t worker, NodeId id, std::string_view target);
+    std::string symlink_target(NodeId id) const;
+    
+    // Record a directory's timestamps; call right after creating it, from
+    // the same worker, so each lane's list stays ordered
+    void set_stamp(size_t worker, NodeId id, const DirStamp& stamp);
+    // Same, for a directory whose timestamps are only known once another
+    // worker gets to it
+    void set_late_stamp(NodeId id, const DirStamp& stamp);
+    bool find_stamp(NodeId id, DirStamp& out) const;
+
+    bool has_children(NodeId id) const;
+    std::vector<NodeId> children(NodeId id) const;
+    template<class F>
+    void for_each_child(NodeId id, F&& f) const;
+    // Replace the child list of a (non-virtual) node, relinking in order
+    void set_children(NodeId id, const std::vector<NodeId>& ordered);
+    // Take child out of parent's list; the node itself stays allocated
+    void unlink_child(NodeId parent, NodeId child);
+    // Whether id still hangs off a root (grouping nodes always do)
+    bool attached(NodeId id) const;
+    // Add to the size and entry count of id and every directory above it
+    void apply_delta(NodeId id, int64_t size_delta, int64_t count_delta);
+
+    size_t node_count() const;
+    size_t node_bytes() const;
+    size_t string_bytes() const;
+    size_t shared_name_count() const;
+};
+
+// Put ids in mode order. With a limit only the first limit entries are
+// selected and sorted; the rest follow in no particular order.
+void order_children(const NodeStore& store, std::vector<NodeId>& ids, SortMode mode,
+                    size_t limit = 0);
+
+// Child orderings, built the first time a directory is shown in a given
+// mode and kept until something below it changes
+class ChildOrderCache {
+private:
+    struct Ordering {
+        std::vector<NodeId> children;
+        size_t sorted = 0;      // Leading entries known to be in order
+    };
+    
+    const NodeStore& store;
+    std::unordered_map<uint64_t, Ordering> orderings;   // (dir << 8) | mode
+    
+public:
+    explicit ChildOrderCache(const NodeStore& nodes) : store(nodes) {}
+    
+    // Children of dir with at least the first limit in order (0 for all)
+    const std::vector<NodeId>& get(NodeId dir, SortMode mode, size_t limit = 0);
+    // Forget dir and its ancestors after its children or size changed
+    void invalidate(NodeId dir);
+    void clear() { orderings.clear(); }
+};
+
+// Template implementation for NodeStore
+template<class F>
+void NodeStore::for_each_child(NodeId id, F&& f) const {
+    const Node& node = (*this)[id];
+    if (node.flags & NODE_VIRTUAL) {
+        std::vector<NodeId> members;
+        {
+            std::lock_guard<std::mutex> lock(side_mutex);
+            members = virtual_members[node.first_child];
+        }
+        for (NodeId child : members) {
+            f(child);
+        }
+        return;
+    }
+    for (NodeId child = node.first_child; child != INVALID_NODE; child = (*this)[child].next_sibling) {
+        f(child);
+    }
+}
+
+#endif // DUA_TREE_H
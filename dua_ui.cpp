@@ -1,5 +1,6 @@
 // dua_ui.cpp - UI functionality implementation
 #include "dua_ui.h"
+#include <cerrno>
 #include <ctime>
 #include <cstring>
 
@@ -11,7 +12,7 @@ bool LineCache::operator!=(const LineCache& other) const {
 }
 
 // MarkPane implementation
-MarkPane::MarkPane(Config& cfg) : config(cfg) {}
+MarkPane::MarkPane(Config& cfg, NodeStore& nodes) : config(cfg), store(nodes) {}
 
 void MarkPane::set_focus(bool focus) {
     has_focus = focus;
@@ -29,7 +30,7 @@ uintmax_t MarkPane::total_size() const {
     return std::accumulate(marked_sizes.begin(), marked_sizes.end(), uintmax_t(0));
 }
 
-void MarkPane::update_marked_items(const std::vector<std::shared_ptr<Entry>>& roots) {
+void MarkPane::update_marked_items(const std::vector<NodeId>& roots) {
     marked_items.clear();
     marked_paths.clear();
     marked_sizes.clear();
@@ -47,7 +48,7 @@ void MarkPane::update_marked_items(const std::vector<std::shared_ptr<Entry>>& ro
         });
     
     // Reorder vectors
-    std::vector<std::shared_ptr<Entry>> sorted_items;
+    std::vector<NodeId> sorted_items;
     std::vector<std::string> sorted_paths;
     std::vector<uintmax_t> sorted_sizes;
     
@@ -109,7 +110,7 @@ void MarkPane::navigate_end() {
 
 void MarkPane::remove_selected() {
     if (selected_index < marked_items.size()) {
-        marked_items[selected_index]->marked = false;
+        store[marked_items[selected_index]].set_flag(NODE_MARKED, false);
         marked_items.erase(marked_items.begin() + selected_index);
         marked_paths.erase(marked_paths.begin() + selected_index);
         marked_sizes.erase(marked_sizes.begin() + selected_index);
@@ -122,8 +123,8 @@ void MarkPane::remove_selected() {
 }
 
 void MarkPane::remove_all() {
-    for (auto& item : marked_items) {
-        item->marked = false;
+    for (NodeId item : marked_items) {
+        store[item].set_flag(NODE_MARKED, false);
     }
     marked_items.clear();
     marked_paths.clear();
@@ -132,7 +133,7 @@ void MarkPane::remove_all() {
     view_offset = 0;
 }
 
-std::vector<std::shared_ptr<Entry>> MarkPane::get_all_marked() const {
+std::vector<NodeId> MarkPane::get_all_marked() const {
     return marked_items;
 }
 
@@ -167,18 +168,18 @@ void MarkPane::draw(WINDOW* win, int height, int width) {
     wrefresh(win);
 }
 
-void MarkPane::collect_marked_recursive(std::shared_ptr<Entry> entry) {
-    if (entry->marked.load()) {
-        marked_items.push_back(entry);
-        marked_paths.push_back(entry->path.string());
-        marked_sizes.push_back(entry->size.load());
+void MarkPane::collect_marked_recursive(NodeId id) {
+    const Node& node = store[id];
+    if (node.is_marked()) {
+        marked_items.push_back(id);
+        marked_paths.push_back(store.path(id).string());
+        marked_sizes.push_back(node.size);
     }
     
-    if (entry->is_directory && !entry->is_symlink) {
-        std::lock_guard<std::mutex> lock(entry->children_mutex);
-        for (auto& child : entry->children) {
+    if (node.is_directory() && !node.is_symlink()) {
+        store.for_each_child(id, [this](NodeId child) {
             collect_marked_recursive(child);
-        }
+        });
     }
 }
 
@@ -463,7 +464,7 @@ void MarkPane::draw_marked_files(WINDOW* win, int height, int width) {
         }
         
         // Draw with colors
-        auto& item = marked_items[i];
+        const Node& item = store[marked_items[i]];
         
         // Size in green (right-aligned in fixed width column)
         wattron(win, COLOR_PAIR(3));
@@ -475,17 +476,17 @@ void MarkPane::draw_marked_files(WINDOW* win, int height, int width) {
         
         // Path with appropriate color at fixed position
         wmove(win, y, path_start);
-        if (item->is_symlink) {
+        if (item.is_symlink()) {
             wattron(win, COLOR_PAIR(9));  // Magenta for symlinks
-        } else if (item->is_directory) {
+        } else if (item.is_directory()) {
             wattron(win, COLOR_PAIR(1) | A_BOLD);  // Cyan bold for directories
         }
         
         wprintw(win, "%s", path_str.c_str());
         
-        if (item->is_symlink || item->is_directory) {
-            wattroff(win, COLOR_PAIR(item->is_symlink ? 9 : 1) | 
-                    (item->is_directory ? A_BOLD : 0));
+        if (item.is_symlink() || item.is_directory()) {
+            wattroff(win, COLOR_PAIR(item.is_symlink() ? 9 : 1) | 
+                    (item.is_directory() ? A_BOLD : 0));
         }
         
         if (is_selected) {
@@ -508,18 +509,13 @@ void MarkPane::draw_marked_files(WINDOW* win, int height, int width) {
 }
 
 // InteractiveUI implementation
-InteractiveUI::InteractiveUI(std::vector<std::shared_ptr<Entry>> root_entries, Config& cfg) 
-    : roots(root_entries), config(cfg), mark_pane(cfg) {
+InteractiveUI::InteractiveUI(WorkStealingThreadPool& workers, NodeStore& nodes,
+                             std::vector<NodeId> root_entries, Config& cfg) 
+    : store(nodes), roots(root_entries), config(cfg), pool(workers),
+      scanner(workers, cfg, nodes), mark_pane(cfg, nodes), child_order(nodes) {
     
     if (roots.size() > 1) {
-        auto virtual_root = std::make_shared<Entry>("");
-        virtual_root->is_directory = true;
-        for (auto& root : roots) {
-            virtual_root->children.push_back(root);
-            virtual_root->size += root->size.load();
-            virtual_root->entry_count += root->entry_count.load();
-        }
-        current_dir = virtual_root;
+        current_dir = store.make_virtual("", roots);
     } else {
         current_dir = roots[0];
     }
@@ -527,6 +523,10 @@ InteractiveUI::InteractiveUI(std::vector<std::shared_ptr<Entry>> root_entries, C
     update_view();
     navigation_stack.push_back(current_dir);
     line_cache.reserve(LINES);
+    
+    if (config.watch) {
+        start_watch();
+    }
 }
 
 InteractiveUI::~InteractiveUI() {
@@ -590,6 +590,9 @@ void InteractiveUI::run() {
     int pending_move = 0;
     
     while (running) {
+        poll_background();
+        validate_visible();
+        
         // Draw main window
         if (needs_full_redraw) {
             draw_full();
@@ -605,6 +608,13 @@ void InteractiveUI::run() {
         
         int ch = getch();
         if (ch != ERR) {
+            // Any key dismisses the deletion failures
+            if (show_failures) {
+                show_failures = false;
+                needs_full_redraw = true;
+                continue;
+            }
+            
             // Handle terminal resize
             if (ch == KEY_RESIZE) {
                 handle_resize();
@@ -637,7 +647,7 @@ void InteractiveUI::run() {
                     
                     // Update preview after batched movement
                     if (mark_pane.is_quickview_active() && selected_index < current_view.size()) {
-                        mark_pane.activate_quickview(current_view[selected_index]->path);
+                        mark_pane.activate_quickview(store.path(current_view[selected_index]));
                     }
                 }
                 
@@ -649,7 +659,7 @@ void InteractiveUI::run() {
                 
                 // Update preview if quickview is active
                 if (mark_pane.is_quickview_active() && selected_index < current_view.size()) {
-                    mark_pane.activate_quickview(current_view[selected_index]->path);
+                    mark_pane.activate_quickview(store.path(current_view[selected_index]));
                 }
                 
                 last_input_time = now;
@@ -669,7 +679,7 @@ void InteractiveUI::run() {
                 
                 // Update preview after batched movement
                 if (mark_pane.is_quickview_active() && selected_index < current_view.size()) {
-                    mark_pane.activate_quickview(current_view[selected_index]->path);
+                    mark_pane.activate_quickview(store.path(current_view[selected_index]));
                 }
             }
             napms(50);  // Increased from 10ms to 50ms for lower CPU usage
@@ -768,65 +778,15 @@ void InteractiveUI::apply_movement(int delta) {
 
 void InteractiveUI::update_view() {
     format_cache.clear();
-    current_view.clear();
-    {
-        std::lock_guard<std::mutex> lock(current_dir->children_mutex);
-        current_view = current_dir->children;
-    }
     apply_sort();
+    if (watcher) {
+        watcher->focus(current_dir);
+    }
 }
 
 void InteractiveUI::apply_sort() {
-    switch (sort_mode) {
-        case SortMode::SIZE_DESC:
-            std::sort(current_view.begin(), current_view.end(),
-                [](const std::shared_ptr<Entry>& a, const std::shared_ptr<Entry>& b) { 
-                    return a->size.load() > b->size.load(); 
-                });
-            break;
-        case SortMode::SIZE_ASC:
-            std::sort(current_view.begin(), current_view.end(),
-                [](const std::shared_ptr<Entry>& a, const std::shared_ptr<Entry>& b) { 
-                    return a->size.load() < b->size.load(); 
-                });
-            break;
-        case SortMode::NAME_ASC:
-            std::sort(current_view.begin(), current_view.end(),
-                [](const std::shared_ptr<Entry>& a, const std::shared_ptr<Entry>& b) { 
-                    return a->path.filename() < b->path.filename(); 
-                });
-            break;
-        case SortMode::NAME_DESC:
-            std::sort(current_view.begin(), current_view.end(),
-                [](const std::shared_ptr<Entry>& a, const std::shared_ptr<Entry>& b) { 
-                    return a->path.filename() > b->path.filename(); 
-                });
-            break;
-        case SortMode::TIME_DESC:
-            std::sort(current_view.begin(), current_view.end(),
-                [](const std::shared_ptr<Entry>& a, const std::shared_ptr<Entry>& b) { 
-                    return a->last_modified > b->last_modified; 
-                });
-            break;
-        case SortMode::TIME_ASC:
-            std::sort(current_view.begin(), current_view.end(),
-                [](const std::shared_ptr<Entry>& a, const std::shared_ptr<Entry>& b) { 
-                    return a->last_modified < b->last_modified; 
-                });
-            break;
-        case SortMode::COUNT_DESC:
-            std::sort(current_view.begin(), current_view.end(),
-                [](const std::shared_ptr<Entry>& a, const std::shared_ptr<Entry>& b) { 
-                    return a->entry_count.load() > b->entry_count.load(); 
-                });
-            break;
-        case SortMode::COUNT_ASC:
-            std::sort(current_view.begin(), current_view.end(),
-                [](const std::shared_ptr<Entry>& a, const std::shared_ptr<Entry>& b) { 
-                    return a->entry_count.load() < b->entry_count.load(); 
-                });
-            break;
-    }
+    // Orderings are cached, so going back to a directory or mode costs a copy
+    current_view = child_order.get(current_dir, sort_mode);
 }
 
 // Drawing method implementations
@@ -844,22 +804,7 @@ void InteractiveUI::draw_full() {
     wattroff(win, A_REVERSE);
     
     // Path bar
-    wattron(win, A_REVERSE);
-    mvwhline(win, 1, 0, ' ', width);
-    std::string path_str = current_dir->path.string();
-    if (path_str.empty()) path_str = "[root]";
-    mvwprintw(win, 1, 1, " %s", path_str.c_str());
-    
-    // Stats on the right
-    if (!current_view.empty()) {
-        std::string info = "(" + std::to_string(current_view.size()) + " visible, " +
-                          std::to_string(current_dir->entry_count.load()) + " total, " +
-                          format_size(current_dir->size, config.format) + ")";
-        if (info.length() + 2 < static_cast<size_t>(width)) {
-            mvwprintw(win, 1, width - info.length() - 2, "%s", info.c_str());
-        }
-    }
-    wattroff(win, A_REVERSE);
+    draw_path_bar(win, width);
     
     // File list
     int y = 2;
@@ -882,13 +827,18 @@ void InteractiveUI::draw_full() {
         if (!mark_pane.is_empty()) {
             wprintw(win, "mark pane = Tab | ");
         }
-        wprintw(win, "delete = d | search = / | refresh = r/R");
+        wprintw(win, "delete = d | search = / | refresh = r/R | live = w");
     }
     
     if (show_help) {
         draw_help(win);
     }
     
+    if (show_failures) {
+        draw_failures(win);
+    }
+    entries_changed = false;
+    
     // Remember current state
     last_selected_index = selected_index;
     last_view_offset = view_offset;
@@ -904,13 +854,24 @@ void InteractiveUI::draw_differential() {
     bool selection_changed = (selected_index != last_selected_index);
     bool view_scrolled = (view_offset != last_view_offset);
     
-    if (!selection_changed && !view_scrolled) {
+    if (!selection_changed && !view_scrolled && !entries_changed) {
         return;  // Nothing to update
     }
     
     int y = 2;
     int max_y = height - 2;
     
+    // Live updates change sizes and order, but not the frame around them.
+    // They wait while the failures popup covers the list.
+    if (entries_changed) {
+        if (show_failures) {
+            return;
+        }
+        draw_path_bar(win, width);
+        entries_changed = false;
+        view_scrolled = true;
+    }
+    
     // If view scrolled, we need to redraw all visible lines
     if (view_scrolled) {
         for (size_t i = view_offset; i < current_view.size() && y < max_y; i++) {
@@ -950,18 +911,38 @@ void InteractiveUI::draw_differential() {
     wrefresh(win);
 }
 
+void InteractiveUI::draw_path_bar(WINDOW* win, int width) {
+    wattron(win, A_REVERSE);
+    mvwhline(win, 1, 0, ' ', width);
+    std::string path_str = store.path(current_dir).string();
+    if (path_str.empty()) path_str = "[root]";
+    mvwprintw(win, 1, 1, " %s", path_str.c_str());
+    
+    // Stats on the right
+    if (!current_view.empty()) {
+        std::string info = "(" + std::to_string(current_view.size()) + " visible, " +
+                          std::to_string(store[current_dir].entry_count) + " total, " +
+                          format_size(store[current_dir].size, config.format) + ")";
+        if (info.length() + 2 < static_cast<size_t>(width)) {
+            mvwprintw(win, 1, width - info.length() - 2, "%s", info.c_str());
+        }
+    }
+    wattroff(win, A_REVERSE);
+}
+
 void InteractiveUI::draw_entry_line(size_t index, int y, bool force_redraw, WINDOW* win, int win_width) {
     (void)force_redraw; // Suppress unused parameter warning
     if (index >= current_view.size()) return;
     
-    auto entry = current_view[index];
+    NodeId id = current_view[index];
+    const Node& entry = store[id];
     bool is_selected = (index == selected_index);
     bool has_focus = (focused_pane == FocusedPane::Main);
     
     // Get cached formatting or create new
-    auto& cached = format_cache[entry];
+    auto& cached = format_cache[id];
     if (cached.needs_update) {
-        update_format_cache(entry, cached, win_width);
+        update_format_cache(id, cached, win_width);
     }
     
     // Move to line position
@@ -984,7 +965,7 @@ void InteractiveUI::draw_entry_line(size_t index, int y, bool force_redraw, WIND
     int col_x = 0;
     
     // Mark indicator
-    if (entry->marked.load()) {
+    if (entry.is_marked()) {
         if (!is_selected) wattron(win, COLOR_PAIR(8) | A_BOLD);
         mvwaddch(win, y, col_x, '*');
         if (!is_selected) wattroff(win, COLOR_PAIR(8) | A_BOLD);
@@ -1047,11 +1028,7 @@ void InteractiveUI::draw_entry_line(size_t index, int y, bool force_redraw, WIND
         }
         
         // Format the time
-        // Convert file_time_type to time_t (C++17 compatible way)
-        auto file_time_epoch = entry->last_modified.time_since_epoch();
-        auto sys_time_epoch = std::chrono::duration_cast<std::chrono::system_clock::duration>(file_time_epoch);
-        auto sys_time = std::chrono::system_clock::time_point(sys_time_epoch);
-        auto time_t_val = std::chrono::system_clock::to_time_t(sys_time);
+        std::time_t time_t_val = static_cast<std::time_t>(entry.mtime);
         
         std::tm* tm = std::localtime(&time_t_val);
         char time_buffer[20];
@@ -1083,8 +1060,8 @@ void InteractiveUI::draw_entry_line(size_t index, int y, bool force_redraw, WIND
             wattron(win, COLOR_PAIR(2));
         }
         
-        if (entry->entry_count.load() > 0) {
-            mvwprintw(win, y, col_x, "%6llu", (unsigned long long)entry->entry_count.load());
+        if (entry.entry_count > 0) {
+            mvwprintw(win, y, col_x, "%6llu", (unsigned long long)entry.entry_count);
         } else {
             mvwprintw(win, y, col_x, "     -");
         }
@@ -1099,16 +1076,16 @@ void InteractiveUI::draw_entry_line(size_t index, int y, bool force_redraw, WIND
     mvwprintw(win, y, col_x, " | ");
     col_x += 3;
     
-    if (entry->is_symlink && !is_selected) {
+    if (entry.is_symlink() && !is_selected) {
         wattron(win, COLOR_PAIR(9));
-    } else if (entry->is_directory && !is_selected) {
+    } else if (entry.is_directory() && !is_selected) {
         wattron(win, COLOR_PAIR(1) | A_BOLD);
     }
     
     mvwprintw(win, y, col_x, "%s", cached.formatted_name.c_str());
     
-    if ((entry->is_symlink || entry->is_directory) && !is_selected) {
-        wattroff(win, COLOR_PAIR(entry->is_symlink ? 9 : 1) | (entry->is_directory ? A_BOLD : 0));
+    if ((entry.is_symlink() || entry.is_directory()) && !is_selected) {
+        wattroff(win, COLOR_PAIR(entry.is_symlink() ? 9 : 1) | (entry.is_directory() ? A_BOLD : 0));
     }
     
     if (is_selected) {
@@ -1120,22 +1097,27 @@ void InteractiveUI::draw_entry_line(size_t index, int y, bool force_redraw, WIND
     }
 }
 
-void InteractiveUI::update_format_cache(std::shared_ptr<Entry> entry, CachedEntry& cached, int win_width) {
-    cached.formatted_size = format_size(entry->size, config.format);
-    cached.percentage = (current_dir->size > 0) ? 
-        (static_cast<double>(entry->size.load()) / current_dir->size.load() * 100.0) : 0.0;
+void InteractiveUI::update_format_cache(NodeId id, CachedEntry& cached, int win_width) {
+    const Node& entry = store[id];
+    const Node& dir = store[current_dir];
+    cached.formatted_size = format_size(entry.size, config.format);
+    cached.percentage = (dir.size > 0) ? 
+        (static_cast<double>(entry.size) / dir.size * 100.0) : 0.0;
     
-    std::string name = entry->path.filename().string();
-    if (name.empty()) name = entry->path.string();
+    std::string name = store.display_name(id);
     
-    if (entry->is_symlink) {
-        cached.formatted_name = " " + name + " -> " + entry->symlink_target.string();
-    } else if (entry->is_directory) {
+    if (entry.is_symlink()) {
+        cached.formatted_name = " " + name + " -> " + store.symlink_target(id);
+    } else if (entry.is_directory()) {
         cached.formatted_name = "/" + name;
     } else {
         cached.formatted_name = " " + name;
     }
     
+    if (entry.is_incomplete()) {
+        cached.formatted_name += " (incomplete)";
+    }
+    
     // Calculate available width for name based on enabled columns
     int used_width = 1 + 10 + 3 + 8 + 3 + 20;  // mark + size + sep + % + sep + bar
     if (show_mtime) {
@@ -1178,6 +1160,31 @@ void InteractiveUI::update_status_line(WINDOW* win, int height, int width) {
         }
     }
     
+    if (deleter) {
+        sort_str += "  |  Deleting: " + std::to_string(deleter->removed_count()) + " removed, " +
+                    format_size(deleter->freed_bytes(), config.format) + " freed";
+        if (deleter->failed_count() > 0) {
+            sort_str += ", " + std::to_string(deleter->failed_count()) + " failed";
+        }
+    } else if (!deletion_summary.empty()) {
+        sort_str += "  |  " + deletion_summary;
+    }
+    
+    if (config.polite) {
+        sort_str += "  |  Polite: " + std::to_string(scanner.ops_limit()) + " ops/s";
+    }
+    
+    if (watcher) {
+        sort_str += "  |  Live: ";
+        if (watcher->backend() == TreeWatcher::Backend::Fanotify) {
+            sort_str += "fanotify";
+        } else {
+            sort_str += "inotify, " + std::to_string(watcher->watch_count()) + " dirs";
+        }
+    } else if (!watch_error.empty()) {
+        sort_str += "  |  " + watch_error;
+    }
+    
     wattron(win, A_REVERSE);
     wmove(win, height - 2, 0);
     wclrtoeol(win);
@@ -1194,6 +1201,42 @@ void InteractiveUI::update_status_line(WINDOW* win, int height, int width) {
     wattroff(win, A_REVERSE);
 }
 
+void InteractiveUI::draw_failures(WINDOW* win) {
+    const size_t shown = std::min<size_t>(deletion_failures.size(), 12);
+    int box_height = static_cast<int>(shown) + 6;
+    int box_width = std::min(getmaxx(win) - 4, 90);
+    int box_y = std::max(1, (getmaxy(win) - box_height) / 2);
+    int box_x = std::max(0, (getmaxx(win) - box_width) / 2);
+    int text_width = box_width - 4;
+    
+    wattron(win, COLOR_PAIR(8));
+    for (int i = 0; i < box_height; i++) {
+        mvwhline(win, box_y + i, box_x, ' ', box_width);
+    }
+    
+    wattron(win, A_BOLD);
+    mvwprintw(win, box_y + 1, box_x + 2, "Could not delete %zu entries:", deletion_failures.size());
+    wattroff(win, A_BOLD);
+    
+    int y = box_y + 3;
+    for (size_t i = 0; i < shown; i++) {
+        const auto& failure = deletion_failures[i];
+        std::string reason = std::string(": ") + strerror(failure.error);
+        std::string path = failure.path;
+        int path_width = text_width - static_cast<int>(reason.length());
+        if (static_cast<int>(path.length()) > path_width && path_width > 3) {
+            path = "..." + path.substr(path.length() - path_width + 3);
+        }
+        mvwprintw(win, y++, box_x + 2, "%.*s", text_width, (path + reason).c_str());
+    }
+    if (deletion_failures.size() > shown) {
+        mvwprintw(win, y, box_x + 2, "... and %zu more", deletion_failures.size() - shown);
+    }
+    
+    mvwprintw(win, box_y + box_height - 1, box_x + 2, "Press any key to continue");
+    wattroff(win, COLOR_PAIR(8));
+}
+
 void InteractiveUI::draw_help(WINDOW* win) {
     int help_y = getmaxy(win) / 2 - 12;
     int help_x = getmaxx(win) / 2 - 40;
@@ -1269,6 +1312,10 @@ void InteractiveUI::draw_help(WINDOW* win) {
     mvwprintw(win, y++, right_col + 20, "Glob search");
     mvwprintw(win, y, right_col + 2, "r/R");
     mvwprintw(win, y++, right_col + 20, "Refresh");
+    mvwprintw(win, y, right_col + 2, "w");
+    mvwprintw(win, y++, right_col + 20, "Live updates");
+    mvwprintw(win, y, right_col + 2, "+/-");
+    mvwprintw(win, y++, right_col + 20, "Polite ops/s cap");
     
     // Additional navigation keys (left column continued)
     y = help_y + 17;
@@ -1323,7 +1370,7 @@ bool InteractiveUI::handle_key(int ch) {
                 check_mark_pane_visibility();
                 needs_full_redraw = true;
             } else if (selected_index < current_view.size()) {
-                current_view[selected_index]->marked = true;
+                store[current_view[selected_index]].set_flag(NODE_MARKED, true);
                 mark_pane.update_marked_items(roots);  // Update immediately
                 mark_pane.switch_tab(2);  // Switch to marked files tab
                 navigate_down();
@@ -1337,8 +1384,7 @@ bool InteractiveUI::handle_key(int ch) {
             
         case 'i':  // Quick view
             if (selected_index < current_view.size()) {
-                auto entry = current_view[selected_index];
-                mark_pane.activate_quickview(entry->path);
+                mark_pane.activate_quickview(store.path(current_view[selected_index]));
                 mark_pane.switch_tab(1);  // Switch to quickview tab
                 check_mark_pane_visibility();  // Always check visibility
                 needs_full_redraw = true;
@@ -1373,6 +1419,17 @@ bool InteractiveUI::handle_key(int ch) {
             needs_full_redraw = true;
             break;
             
+        case 'w':  // Live updates
+            toggle_watch();
+            needs_full_redraw = true;
+            break;
+            
+        case '+':  // --polite cap
+        case '-':
+            step_ops_limit(ch == '+');
+            needs_full_redraw = true;
+            break;
+            
         case '?':
             show_help = !show_help;
             needs_full_redraw = true;
@@ -1701,39 +1758,45 @@ bool InteractiveUI::has_any_marked_items() {
     return has_marked_recursive(current_dir);
 }
 
-bool InteractiveUI::has_marked_recursive(std::shared_ptr<Entry> root) {
-    if (root->marked.load()) {
+bool InteractiveUI::has_marked_recursive(NodeId root) {
+    const Node& node = store[root];
+    if (node.is_marked()) {
         return true;
     }
     
-    if (root->is_directory && !root->is_symlink) {
-        std::lock_guard<std::mutex> lock(root->children_mutex);
-        for (auto& child : root->children) {
-            if (has_marked_recursive(child)) {
-                return true;
+    bool found = false;
+    if (node.is_directory() && !node.is_symlink()) {
+        store.for_each_child(root, [&](NodeId child) {
+            if (!found && has_marked_recursive(child)) {
+                found = true;
             }
-        }
+        });
     }
-    return false;
+    return found;
 }
 
 void InteractiveUI::print_marked_paths() {
-    std::vector<std::shared_ptr<Entry>> marked_entries;
+    std::vector<NodeId> marked_entries;
     
-    for (auto& root : roots) {
+    for (NodeId root : roots) {
         collect_marked_entries(root, marked_entries);
     }
     
-    for (auto& entry : marked_entries) {
-        std::cout << entry->path << "\n";
+    for (NodeId entry : marked_entries) {
+        std::cout << store.path(entry) << "\n";
     }
 }
 
 // Additional helper method implementations
 void InteractiveUI::enter_directory() {
     if (selected_index < current_view.size()) {
-        auto selected = current_view[selected_index];
-        if (selected->is_directory && !selected->is_symlink && !selected->children.empty()) {
+        NodeId selected = current_view[selected_index];
+        if (!validate_entry(selected)) {
+            follow_tree_changes(true);
+            return;
+        }
+        if (store[selected].is_directory() && !store[selected].is_symlink() && 
+            store.has_children(selected)) {
             current_dir = selected;
             navigation_stack.push_back(current_dir);
             update_view();
@@ -1757,8 +1820,8 @@ void InteractiveUI::exit_directory() {
 
 void InteractiveUI::toggle_mark() {
     if (selected_index < current_view.size()) {
-        auto entry = current_view[selected_index];
-        entry->marked = !entry->marked.load();
+        Node& entry = store[current_view[selected_index]];
+        entry.set_flag(NODE_MARKED, !entry.is_marked());
         
         // Update mark pane immediately to ensure check_mark_pane_visibility works
         mark_pane.update_marked_items(roots);
@@ -1772,8 +1835,8 @@ void InteractiveUI::toggle_mark() {
 
 void InteractiveUI::toggle_all_marks() {
     bool any_marked = has_marked_items();
-    for (auto& entry : current_view) {
-        entry->marked = !any_marked;
+    for (NodeId entry : current_view) {
+        store[entry].set_flag(NODE_MARKED, !any_marked);
     }
     
     // Update mark pane immediately
@@ -1786,8 +1849,8 @@ void InteractiveUI::toggle_all_marks() {
 }
 
 bool InteractiveUI::has_marked_items() {
-    for (const auto& entry : current_view) {
-        if (entry->marked.load()) {
+    for (NodeId entry : current_view) {
+        if (store[entry].is_marked()) {
             return true;
         }
     }
@@ -1818,20 +1881,11 @@ void InteractiveUI::start_glob_search() {
 void InteractiveUI::perform_glob_search() {
     if (glob_pattern.empty()) return;
     
-    std::vector<std::shared_ptr<Entry>> matches;
+    std::vector<NodeId> matches;
     search_entries(current_dir, glob_pattern, matches);
     
     if (!matches.empty()) {
-        auto search_results = std::make_shared<Entry>("[Search Results]");
-        search_results->is_directory = true;
-        search_results->children = matches;
-        
-        for (auto& match : matches) {
-            search_results->size += match->size.load();
-            search_results->entry_count += match->entry_count.load();
-        }
-        
-        current_dir = search_results;
+        current_dir = store.make_virtual("[Search Results]", matches);
         navigation_stack.push_back(current_dir);
         update_view();
         selected_index = 0;
@@ -1839,23 +1893,27 @@ void InteractiveUI::perform_glob_search() {
     }
 }
 
-void InteractiveUI::search_entries(std::shared_ptr<Entry> root, const std::string& pattern, 
-                   std::vector<std::shared_ptr<Entry>>& matches) {
-    if (glob_match(pattern, root->path.filename().string())) {
+void InteractiveUI::search_entries(NodeId root, const std::string& pattern, 
+                   std::vector<NodeId>& matches) {
+    const Node& node = store[root];
+    if (!(node.flags & NODE_VIRTUAL) && glob_match(pattern, store.display_name(root))) {
         matches.push_back(root);
     }
     
-    if (root->is_directory && !root->is_symlink) {
-        std::lock_guard<std::mutex> lock(root->children_mutex);
-        for (auto& child : root->children) {
+    if (node.is_directory() && !node.is_symlink()) {
+        store.for_each_child(root, [&](NodeId child) {
             search_entries(child, pattern, matches);
-        }
+        });
     }
 }
 
 void InteractiveUI::open_selected() {
     if (selected_index < current_view.size()) {
-        auto selected = current_view[selected_index];
+        NodeId selected = current_view[selected_index];
+        if (!validate_entry(selected)) {
+            follow_tree_changes(true);
+            return;
+        }
         std::string command;
         
 #ifdef __linux__
@@ -1866,13 +1924,13 @@ void InteractiveUI::open_selected() {
         return;
 #endif
         
-        command += "\"" + selected->path.string() + "\" 2>/dev/null &";
+        command += "\"" + store.path(selected).string() + "\" 2>/dev/null &";
         system(command.c_str());
     }
 }
 
 void InteractiveUI::delete_marked_entries() {
-    std::vector<std::shared_ptr<Entry>> marked_entries;
+    std::vector<NodeId> marked_entries;
     collect_marked_entries(current_dir, marked_entries);
     
     if (marked_entries.empty()) return;
@@ -1909,98 +1967,346 @@ void InteractiveUI::delete_marked_entries() {
         return;  // User didn't confirm, abort deletion
     }
     
-    // Proceed with deletion
-    for (auto& entry : marked_entries) {
-        try {
-            if (entry->is_directory && !entry->is_symlink) {
-                fs::remove_all(entry->path);
-            } else {
-                fs::remove(entry->path);
-            }
-            entry->marked = false;
-        } catch (...) {
-            // Continue with other files
-        }
-    }
-    
-    mark_pane.remove_all();
-    refresh_all();
+    start_deletion(marked_entries);
 }
 
-void InteractiveUI::collect_marked_entries(std::shared_ptr<Entry> root, 
-                           std::vector<std::shared_ptr<Entry>>& marked) {
-    if (root->marked.load()) {
+void InteractiveUI::collect_marked_entries(NodeId root, std::vector<NodeId>& marked) {
+    const Node& node = store[root];
+    if (node.is_marked()) {
         marked.push_back(root);
-    } else if (root->is_directory && !root->is_symlink) {
-        std::lock_guard<std::mutex> lock(root->children_mutex);
-        for (auto& child : root->children) {
+    } else if (node.is_directory() && !node.is_symlink()) {
+        store.for_each_child(root, [&](NodeId child) {
             collect_marked_entries(child, marked);
-        }
+        });
     }
 }
 
 void InteractiveUI::refresh_selected() {
+    settle_deletion();
     if (selected_index < current_view.size()) {
-        auto selected = current_view[selected_index];
-        if (selected->is_directory && !selected->is_symlink) {
+        NodeId selected = current_view[selected_index];
+        if (store[selected].is_directory() && !store[selected].is_symlink()) {
             clear();
             mvprintw(LINES / 2, COLS / 2 - 10, "Refreshing...");
             refresh();
             
-            WorkStealingThreadPool pool(config.thread_count);
-            OptimizedScanner scanner(pool, config);
-            
-            {
-                std::lock_guard<std::mutex> lock(selected->children_mutex);
-                selected->children.clear();
+            // Refreshed subtrees stay in the store until a full refresh;
+            // once they make up half of it, have that instead
+            if (detached_nodes * 2 > store.node_count()) {
+                refresh_all();
+                return;
             }
-            
-            auto new_entries = scanner.scan({selected->path});
-            if (!new_entries.empty()) {
-                selected->children = new_entries[0]->children;
-                selected->size = new_entries[0]->size.load();
-                selected->entry_count = new_entries[0]->entry_count.load();
-            }
-            
+            rescan_directory(selected);
+            update_virtual_totals();
             update_view();
         }
     }
 }
 
+void InteractiveUI::rescan_directory(NodeId dir) {
+    // Hard links counted outside dir stay counted there, and those dir
+    // counted itself are up for the rescan to count again
+    std::vector<fs::path> counted;
+    std::vector<fs::path> released;
+    size_t replaced = 1;    // The fresh root
+    store.for_each_child(dir, [&](NodeId child) {
+        collect_counted_links(child, INVALID_NODE, released, replaced);
+    });
+    if (!config.count_hard_links) {
+        if (!inodes_seeded) {
+            size_t outside = 0;
+            for (NodeId root : roots) {
+                collect_counted_links(root, dir, counted, outside);
+            }
+            inodes_seeded = true;
+        }
+        scanner.keep_counted_inodes(counted, released);
+    }
+    
+    // Rescan into a fresh root and adopt its children; the old subtree is
+    // unlinked and stays in the arena until the next full refresh
+    auto new_entries = run_scan({store.path(dir)});
+    if (new_entries.empty()) return;
+    detached_nodes += replaced;
+    
+    const Node& fresh = store[new_entries[0]];
+    Node& node = store[dir];
+    for (NodeId old : store.children(dir)) {
+        store[old].parent = INVALID_NODE;
+    }
+    store.set_children(dir, store.children(new_entries[0]));
+    if (watcher) {
+        watcher->subtree_replaced(dir);
+    }
+    store.apply_delta(dir, static_cast<int64_t>(fresh.size) - static_cast<int64_t>(node.size),
+                      static_cast<int64_t>(fresh.entry_count) - node.entry_count);
+    node.set_flag(NODE_INCOMPLETE, fresh.is_incomplete());
+    child_order.invalidate(dir);
+}
+
+void InteractiveUI::collect_counted_links(NodeId id, NodeId skip,
+                                          std::vector<fs::path>& links, size_t& nodes) {
+    if (id == skip) return;
+    const Node& node = store[id];
+    nodes++;
+    if ((node.flags & NODE_HARDLINK) && !(node.flags & NODE_DUPLICATE)) {
+        links.push_back(store.path(id));
+    }
+    if (node.is_directory() && !node.is_symlink()) {
+        store.for_each_child(id, [&](NodeId child) {
+            collect_counted_links(child, skip, links, nodes);
+        });
+    }
+}
+
+std::vector<NodeId> InteractiveUI::run_scan(const std::vector<fs::path>& paths) {
+    if (!config.polite) {
+        return scanner.scan(paths);
+    }
+    
+    // A polite scan takes a while: keep taking + and - for the cap, and
+    // show the rate here rather than on stderr underneath the screen
+    bool show_progress = config.show_progress;
+    config.show_progress = false;
+    std::vector<NodeId> found;
+    std::atomic<bool> done{false};
+    std::thread scan_thread([&] {
+        found = scanner.scan(paths);
+        done.store(true, std::memory_order_release);
+    });
+    
+    while (!done.load(std::memory_order_acquire)) {
+        int ch = getch();
+        if (ch == '+' || ch == '-') {
+            step_ops_limit(ch == '+');
+        }
+        std::string line = std::to_string(scanner.entries_so_far()) + " entries at " +
+                           std::to_string(static_cast<size_t>(scanner.ops_rate())) + 
+                           " ops/s (cap " + std::to_string(scanner.ops_limit()) + ", +/- to change)";
+        move(LINES / 2 + 1, 0);
+        clrtoeol();
+        mvprintw(LINES / 2 + 1, std::max(0, (COLS - static_cast<int>(line.size())) / 2), 
+                 "%s", line.c_str());
+        refresh();
+        napms(100);
+    }
+    scan_thread.join();
+    config.show_progress = show_progress;
+    return found;
+}
+
+void InteractiveUI::step_ops_limit(bool raise) {
+    if (!config.polite) return;
+    scanner.set_ops_limit(::step_ops_limit(scanner.ops_limit(), raise));
+    config.polite_ops = scanner.ops_limit();
+}
+
+void InteractiveUI::update_virtual_totals() {
+    // Grouping nodes only sum their members when they are made
+    for (NodeId id : navigation_stack) {
+        Node& node = store[id];
+        if (!(node.flags & NODE_VIRTUAL)) continue;
+        
+        uint64_t size = 0;
+        uint64_t entries = 0;
+        store.for_each_child(id, [&](NodeId member) {
+            size += store[member].size;
+            entries += store[member].entry_count;
+        });
+        node.size = size;
+        node.entry_count = static_cast<uint32_t>(entries);
+    }
+}
+
+void InteractiveUI::detach_entry(NodeId id) {
+    const Node& node = store[id];
+    NodeId parent = node.parent;
+    if (parent == INVALID_NODE) {
+        // A root stays in place with nothing left under it
+        store.apply_delta(id, -static_cast<int64_t>(node.size),
+                          -static_cast<int64_t>(node.entry_count));
+        return;
+    }
+    store.apply_delta(parent, -static_cast<int64_t>(node.size), 
+                      -static_cast<int64_t>(node.entry_count));
+    store.unlink_child(parent, id);
+    child_order.invalidate(parent);
+}
+
+bool InteractiveUI::validate_entry(NodeId id) {
+    if (!config.no_entry_check || !validated.insert(id).second) return true;
+    
+    Node& node = store[id];
+    if (node.flags & (NODE_ROOT | NODE_VIRTUAL)) return true;
+    
+    EntryStat st;
+    if (!stat_entry(store.path(id), st)) {
+        // Only an entry that is known to be gone is pruned
+        if (errno != ENOENT && errno != ENOTDIR) return true;
+        detach_entry(id);
+        return false;
+    }
+    
+    // Files also pick up a size that changed since the scan
+    if (st.type == DirEntryType::Regular && !node.is_directory() && !node.is_symlink() &&
+        !(node.flags & NODE_DUPLICATE)) {
+        uint64_t size = config.apparent_size ? st.size : get_size_on_disk(st);
+        if (size != node.size) {
+            store.apply_delta(id, static_cast<int64_t>(size) - static_cast<int64_t>(node.size),
+                              (size > 0 ? 1 : 0) - static_cast<int64_t>(node.entry_count));
+            child_order.invalidate(node.parent);
+        }
+        node.mtime = st.mtime_sec;
+    }
+    return true;
+}
+
+void InteractiveUI::validate_visible() {
+    if (!config.no_entry_check) return;
+    
+    // Pruning shifts the view, which can bring more unchecked entries in
+    bool removed = true;
+    while (removed) {
+        removed = false;
+        size_t end = std::min(current_view.size(), view_offset + std::max(LINES - 4, 0));
+        for (size_t i = view_offset; i < end; i++) {
+            if (!validate_entry(current_view[i])) {
+                removed = true;
+            }
+        }
+        if (removed) {
+            follow_tree_changes(true);
+        }
+    }
+}
+
 void InteractiveUI::refresh_all() {
+    settle_deletion();
+    deletion_summary.clear();
+    validated.clear();
     clear();
     mvprintw(LINES / 2, COLS / 2 - 10, "Refreshing all...");
     refresh();
     
-    WorkStealingThreadPool pool(config.thread_count);
-    OptimizedScanner scanner(pool, config);
+    // Everything is rescanned, so start over with an empty store
+    fs::path root_path = store.path(roots[0]);
+    bool watching = (watcher != nullptr);
+    watcher.reset();
+    mark_pane.remove_all();
+    child_order.clear();
+    store.clear();
+    // The scan below counts every hard link afresh
+    inodes_seeded = true;
+    detached_nodes = 0;
     
     if (roots.size() > 1) {
-        roots = scanner.scan(config.paths);
-        
-        auto virtual_root = std::make_shared<Entry>("");
-        virtual_root->is_directory = true;
-        for (auto& root : roots) {
-            virtual_root->children.push_back(root);
-            virtual_root->size += root->size.load();
-            virtual_root->entry_count += root->entry_count.load();
-        }
+        roots = run_scan(config.paths);
         
         navigation_stack.clear();
-        current_dir = virtual_root;
+        current_dir = store.make_virtual("", roots);
         navigation_stack.push_back(current_dir);
     } else {
-        roots = scanner.scan({roots[0]->path});
+        roots = run_scan({root_path});
         navigation_stack.clear();
         current_dir = roots[0];
         navigation_stack.push_back(current_dir);
     }
     
+    if (watching) {
+        start_watch();
+    }
     update_view();
     selected_index = 0;
     view_offset = 0;
 }
 
+void InteractiveUI::start_watch() {
+    watcher = std::make_unique<TreeWatcher>(store, config);
+    std::string error;
+    if (!watcher->start(roots, error)) {
+        watcher.reset();
+        watch_error = "Live updates unavailable (" + error + ")";
+        return;
+    }
+    watch_error.clear();
+    watcher->focus(current_dir);
+    last_poll = std::chrono::steady_clock::now();
+}
+
+void InteractiveUI::toggle_watch() {
+    if (watcher) {
+        watcher.reset();
+        watch_error.clear();
+    } else {
+        start_watch();
+    }
+}
+
+void InteractiveUI::poll_background() {
+    auto now = std::chrono::steady_clock::now();
+    if ((!watcher && !deleter) || now - last_poll < POLL_INTERVAL) return;
+    last_poll = now;
+    
+    bool removed = false;
+    bool changed = poll_deletion(removed);
+    changed = poll_watch(removed) || changed;
+    if (changed) {
+        follow_tree_changes(removed);
+    }
+}
+
+bool InteractiveUI::poll_watch(bool& removed) {
+    if (!watcher || !watcher->poll(watch_changes)) return false;
+    
+    for (NodeId dir : watch_changes.dirs) {
+        child_order.invalidate(dir);
+    }
+    removed = removed || !watch_changes.removed.empty();
+    return true;
+}
+
+void InteractiveUI::follow_tree_changes(bool removed) {
+    NodeId selected = (selected_index < current_view.size()) ? current_view[selected_index] 
+                                                              : INVALID_NODE;
+    update_virtual_totals();
+    
+    // Step out of directories that no longer exist
+    NodeId viewed = current_dir;
+    while (navigation_stack.size() > 1 && !store.attached(navigation_stack.back())) {
+        navigation_stack.pop_back();
+    }
+    current_dir = navigation_stack.back();
+    
+    if (removed && !mark_pane.is_empty()) {
+        mark_pane.update_marked_items(roots);
+        check_mark_pane_visibility();
+    }
+    
+    update_view();
+    
+    if (current_dir != viewed) {
+        selected_index = 0;
+        view_offset = 0;
+        needs_full_redraw = true;
+        return;
+    }
+    
+    // Keep the cursor on the same entry while the order shifts around it
+    auto it = std::find(current_view.begin(), current_view.end(), selected);
+    if (it != current_view.end()) {
+        selected_index = static_cast<size_t>(it - current_view.begin());
+    } else if (selected_index >= current_view.size()) {
+        selected_index = current_view.empty() ? 0 : current_view.size() - 1;
+    }
+    int max_visible = LINES - 4;
+    if (selected_index < view_offset) {
+        view_offset = selected_index;
+    } else if (static_cast<int>(selected_index) >= static_cast<int>(view_offset) + max_visible) {
+        view_offset = selected_index - max_visible + 1;
+    }
+    entries_changed = true;
+}
+
 void InteractiveUI::handle_resize() {
     // Clear and refresh the standard screen
     clear();
@@ -2062,25 +2368,117 @@ void InteractiveUI::delete_marked_from_pane() {
     
     if (marked_entries.empty()) return;
     
-    for (auto& entry : marked_entries) {
-        try {
-            if (entry->is_directory && !entry->is_symlink) {
-                fs::remove_all(entry->path);
-            } else {
-                fs::remove(entry->path);
-            }
-            entry->marked = false;
-        } catch (...) {
-            // Continue with other files
+    start_deletion(marked_entries);
+}
+
+void InteractiveUI::start_deletion(const std::vector<NodeId>& entries) {
+    // Entries inside another marked directory go with it
+    std::unordered_set<NodeId> chosen(entries.begin(), entries.end());
+    std::vector<NodeId> targets;
+    for (NodeId id : entries) {
+        bool nested = false;
+        for (NodeId up = store[id].parent; up != INVALID_NODE && !nested; up = store[up].parent) {
+            nested = chosen.count(up) > 0;
+        }
+        if (!nested) {
+            targets.push_back(id);
         }
     }
     
     mark_pane.remove_all();
-    refresh_all();
+    
+    // Entries already gone are taken out here rather than reported as failures
+    size_t before = targets.size();
+    targets.erase(std::remove_if(targets.begin(), targets.end(), 
+                                 [this](NodeId id) {
+                                     validated.erase(id);
+                                     return !validate_entry(id);
+                                 }),
+                  targets.end());
+    if (targets.size() != before) {
+        follow_tree_changes(true);
+    }
+    if (targets.empty()) return;
+    
+    if (!deleter) {
+        deleter = std::make_unique<DeletionEngine>(pool, config);
+        deletion_summary.clear();
+    }
+    for (NodeId id : targets) {
+        deleter->remove(id, store.path(id));
+        deleting.push_back(id);
+    }
+    
+    // The engine accounts for what it frees; keep the watcher out of it
+    if (watcher) {
+        watcher->set_excluded(deleting);
+    }
+    last_poll = std::chrono::steady_clock::time_point{};
 }
 
-void InteractiveUI::remove_from_parent(std::shared_ptr<Entry> entry) {
-    // Simplified implementation
-    entry->size = 0;
-    entry->entry_count = 0;
+bool InteractiveUI::poll_deletion(bool& removed) {
+    if (!deleter) return false;
+    
+    // Once idle, the outcomes collected below are the last ones
+    bool idle = !deleter->busy();
+    deleter->collect(deletion_outcomes);
+    
+    for (const auto& outcome : deletion_outcomes) {
+        NodeId id = outcome.node;
+        if (outcome.freed > 0 || outcome.entries > 0) {
+            store.apply_delta(id, -static_cast<int64_t>(outcome.freed), 
+                              -static_cast<int64_t>(outcome.entries));
+        }
+        
+        NodeId parent = store[id].parent;
+        child_order.invalidate(parent != INVALID_NODE ? parent : id);
+        if (!outcome.finished) continue;
+        
+        deleting.erase(std::remove(deleting.begin(), deleting.end(), id), deleting.end());
+        if (outcome.failed) {
+            if (store[id].is_directory() && !store[id].is_symlink()) {
+                deletion_rescans.push_back(id);
+            }
+        } else if (store.attached(id)) {
+            // Whatever the tree still counts below it is gone as well
+            detach_entry(id);
+            removed = removed || parent != INVALID_NODE;
+        }
+    }
+    if (watcher) {
+        watcher->set_excluded(deleting);
+    }
+    
+    if (idle) {
+        // Partly removed directories are scanned again, nothing else
+        for (NodeId id : deletion_rescans) {
+            if (store.attached(id)) {
+                rescan_directory(id);
+            }
+        }
+        deletion_rescans.clear();
+        
+        deletion_summary = "Deleted " + std::to_string(deleter->removed_count()) + " entries, " +
+                           format_size(deleter->freed_bytes(), config.format) + " freed";
+        if (deleter->failed_count() > 0) {
+            deletion_summary += ", " + std::to_string(deleter->failed_count()) + " failed";
+        }
+        deletion_failures = deleter->take_failures();
+        show_failures = !deletion_failures.empty();
+        if (show_failures) {
+            needs_full_redraw = true;
+        }
+        deleter.reset();
+    }
+    return !deletion_outcomes.empty() || idle;
+}
+
+void InteractiveUI::settle_deletion() {
+    if (!deleter) return;
+    
+    deleter->wait();
+    bool removed = false;
+    if (poll_deletion(removed)) {
+        follow_tree_changes(removed);
+    }
 }
@@ -4,24 +4,14 @@
 
 #include "dua_core.h"
 #include "dua_quickview.h"
+#include "dua_watch.h"
+#include "dua_delete.h"
 #include <ncurses.h>
 
 // Forward declarations
 class MarkPane;
 class InteractiveUI;
 
-// Sorting modes
-enum class SortMode {
-    SIZE_DESC,
-    SIZE_ASC,
-    NAME_ASC,
-    NAME_DESC,
-    TIME_DESC,
-    TIME_ASC,
-    COUNT_DESC,
-    COUNT_ASC
-};
-
 // Focused pane enum
 enum class FocusedPane {
     Main,
@@ -49,19 +39,20 @@ struct CachedEntry {
 // Mark Pane - provides a focused view of all marked items with tab support
 class MarkPane {
 private:
-    std::vector<std::shared_ptr<Entry>> marked_items;
+    std::vector<NodeId> marked_items;
     std::vector<std::string> marked_paths;
     std::vector<uintmax_t> marked_sizes;
     size_t selected_index = 0;
     size_t view_offset = 0;
     bool has_focus = false;
     Config& config;
+    NodeStore& store;
     
     // Tab support
     TabManager tab_manager;
     PreviewContent current_preview;
     
-    void collect_marked_recursive(std::shared_ptr<Entry> entry);
+    void collect_marked_recursive(NodeId id);
     void adjust_view_offset();
     void draw_scrollbar(WINDOW* win, int height, size_t offset, size_t total, int visible);
     void draw_tabs(WINDOW* win, int width);
@@ -69,7 +60,7 @@ private:
     void draw_marked_files(WINDOW* win, int height, int width);
     
 public:
-    MarkPane(Config& cfg);
+    MarkPane(Config& cfg, NodeStore& nodes);
     
     void set_focus(bool focus);
     bool is_focused() const;
@@ -77,7 +68,7 @@ public:
     size_t count() const;
     uintmax_t total_size() const;
     
-    void update_marked_items(const std::vector<std::shared_ptr<Entry>>& roots);
+    void update_marked_items(const std::vector<NodeId>& roots);
     void navigate_up();
     void navigate_down();
     void navigate_page_up();
@@ -86,7 +77,7 @@ public:
     void navigate_end();
     void remove_selected();
     void remove_all();
-    std::vector<std::shared_ptr<Entry>> get_all_marked() const;
+    std::vector<NodeId> get_all_marked() const;
     void draw(WINDOW* win, int height, int width);
     
     // Tab and quickview support
@@ -101,9 +92,10 @@ public:
 // Interactive UI class
 class InteractiveUI {
 private:
-    std::vector<std::shared_ptr<Entry>> roots;
-    std::vector<std::shared_ptr<Entry>> current_view;
-    std::shared_ptr<Entry> current_dir;
+    NodeStore& store;
+    std::vector<NodeId> roots;
+    std::vector<NodeId> current_view;
+    NodeId current_dir = INVALID_NODE;
     size_t selected_index = 0;
     size_t view_offset = 0;
     bool show_help = false;
@@ -111,9 +103,15 @@ private:
     bool show_count = false;
     bool glob_search_active = false;
     std::string glob_pattern;
-    std::vector<std::shared_ptr<Entry>> navigation_stack;
+    std::vector<NodeId> navigation_stack;
     Config& config;
     
+    // Refreshes and deletions reuse the workers of the initial scan
+    WorkStealingThreadPool& pool;
+    OptimizedScanner scanner;
+    bool inodes_seeded = false;     // scanner knows the hard links the tree counts
+    size_t detached_nodes = 0;      // Left in the store by subtree refreshes
+    
     // Mark pane
     MarkPane mark_pane;
     WINDOW* main_win = nullptr;
@@ -134,13 +132,35 @@ private:
     static constexpr auto INPUT_BATCH_DELAY = std::chrono::milliseconds(5);
     
     // Cached formatted strings
-    std::unordered_map<std::shared_ptr<Entry>, CachedEntry> format_cache;
+    std::unordered_map<NodeId, CachedEntry> format_cache;
     
     SortMode sort_mode = SortMode::SIZE_DESC;
+    ChildOrderCache child_order;
     
     // Scan time tracking
     long long scan_time_ms = 0;
     
+    // Live updates
+    std::unique_ptr<TreeWatcher> watcher;
+    WatchChanges watch_changes;
+    std::string watch_error;     // Why live updates could not start
+    bool entries_changed = false;
+    std::chrono::steady_clock::time_point last_poll;
+    static constexpr auto POLL_INTERVAL = std::chrono::milliseconds(200);
+    
+    // Deletions running on the pool
+    std::unique_ptr<DeletionEngine> deleter;
+    std::vector<DeletionEngine::Outcome> deletion_outcomes;
+    std::vector<NodeId> deleting;           // Targets still in flight
+    std::vector<NodeId> deletion_rescans;   // Directories only partly removed
+    std::vector<DeletionEngine::Failure> deletion_failures;
+    std::string deletion_summary;
+    bool show_failures = false;
+    
+    // With --no-entry-check, entries are checked once they are shown,
+    // opened or deleted; these ones already were
+    std::unordered_set<NodeId> validated;
+    
     // Window management
     void update_window_layout();
     void switch_focus();
@@ -158,16 +178,17 @@ private:
     void toggle_all_marks();
     bool has_marked_items();
     bool has_any_marked_items();
-    bool has_marked_recursive(std::shared_ptr<Entry> root);
+    bool has_marked_recursive(NodeId root);
     size_t count_marked_items();
-    void count_marked_recursive(std::shared_ptr<Entry> root, size_t& count);
+    void count_marked_recursive(NodeId root, size_t& count);
     uintmax_t calculate_marked_size();
-    void calculate_marked_size_recursive(std::shared_ptr<Entry> root, uintmax_t& total);
-    void collect_marked_entries(std::shared_ptr<Entry> root, 
-                               std::vector<std::shared_ptr<Entry>>& marked);
+    void calculate_marked_size_recursive(NodeId root, uintmax_t& total);
+    void collect_marked_entries(NodeId root, std::vector<NodeId>& marked);
     void delete_marked_entries();
     void delete_marked_from_pane();
-    void remove_from_parent(std::shared_ptr<Entry> entry);
+    void start_deletion(const std::vector<NodeId>& entries);
+    bool poll_deletion(bool& removed);
+    void settle_deletion();
     
     // Sorting
     void apply_sort();
@@ -180,12 +201,28 @@ private:
     void start_glob_search();
     void handle_glob_search(int ch);
     void perform_glob_search();
-    void search_entries(std::shared_ptr<Entry> root, const std::string& pattern, 
-                       std::vector<std::shared_ptr<Entry>>& matches);
+    void search_entries(NodeId root, const std::string& pattern, 
+                       std::vector<NodeId>& matches);
     
     // Refreshing
     void refresh_selected();
     void refresh_all();
+    void rescan_directory(NodeId dir);
+    void collect_counted_links(NodeId id, NodeId skip, std::vector<fs::path>& links,
+                               size_t& nodes);
+    std::vector<NodeId> run_scan(const std::vector<fs::path>& paths);
+    void step_ops_limit(bool raise);
+    void update_virtual_totals();
+    void detach_entry(NodeId id);
+    bool validate_entry(NodeId id);
+    void validate_visible();
+    
+    // Live updates
+    void start_watch();
+    void toggle_watch();
+    bool poll_watch(bool& removed);
+    void poll_background();
+    void follow_tree_changes(bool removed);
     
     // Window management
     void handle_resize();
@@ -194,10 +231,12 @@ private:
     // Drawing
     void draw_full();
     void draw_differential();
+    void draw_path_bar(WINDOW* win, int width);
     void draw_entry_line(size_t index, int y, bool force_redraw, WINDOW* win, int win_width);
-    void update_format_cache(std::shared_ptr<Entry> entry, CachedEntry& cached, int win_width);
+    void update_format_cache(NodeId id, CachedEntry& cached, int win_width);
     void update_status_line(WINDOW* win, int height, int width);
     void draw_help(WINDOW* win);
+    void draw_failures(WINDOW* win);
     
     // Input handling
     bool handle_key(int ch);
@@ -208,7 +247,8 @@ private:
     void print_marked_paths();
     
 public:
-    InteractiveUI(std::vector<std::shared_ptr<Entry>> root_entries, Config& cfg);
+    InteractiveUI(WorkStealingThreadPool& workers, NodeStore& nodes,
+                  std::vector<NodeId> root_entries, Config& cfg);
     ~InteractiveUI();
     
     void run();
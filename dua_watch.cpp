@@ -0,0 +1,831 @@
+// dua_watch.cpp - Following filesystem changes while browsing
+#include "dua_watch.h"
+#include "dua_core.h"
+#include "dua_fs.h"
+#include <algorithm>
+#include <unordered_set>
+#include <cerrno>
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <sys/fanotify.h>
+#include <sys/statfs.h>
+#endif
+
+// TreeWatcher implementation
+TreeWatcher::TreeWatcher(NodeStore& nodes, const Config& cfg)
+    : store(nodes), config(cfg) {}
+
+TreeWatcher::~TreeWatcher() {
+    stop();
+}
+
+bool TreeWatcher::start(const std::vector<NodeId>& root_entries, std::string& error) {
+    stop();
+    roots = root_entries;
+
+    for (NodeId root : roots) {
+        std::error_code ec;
+        std::string path = fs::weakly_canonical(fs::absolute(store.path(root), ec), ec).string();
+        while (path.size() > 1 && path.back() == '/') {
+            path.pop_back();
+        }
+        root_paths.push_back(ec ? std::string() : path);
+    }
+
+    for (const auto& dir : config.ignore_dirs) {
+        EntryStat st;
+        if (stat_entry(dir, st)) {
+            ignored_dirs.push_back({static_cast<uint64_t>(st.device),
+                                    static_cast<uint64_t>(st.inode)});
+        }
+    }
+
+    for (NodeId root : roots) {
+        seed_links(root);
+    }
+
+#ifdef __linux__
+    std::string fanotify_error;
+    if (start_fanotify(fanotify_error)) {
+        mode = Backend::Fanotify;
+        return true;
+    }
+    if (start_inotify(error)) {
+        mode = Backend::Inotify;
+        return true;
+    }
+    error = fanotify_error + ", " + error;
+    stop();
+    return false;
+#else
+    error = "not supported on this platform";
+    return false;
+#endif
+}
+
+void TreeWatcher::stop() {
+    if (fd >= 0) {
+        close(fd);
+        fd = -1;
+    }
+    for (auto& [fsid, mount_fd] : mount_fds) {
+        close(mount_fd);
+    }
+    mode = Backend::None;
+    mount_fds.clear();
+    handle_nodes.clear();
+    watch_nodes.clear();
+    node_watches.clear();
+    pending.clear();
+    excluded.clear();
+    roots.clear();
+    root_paths.clear();
+    ignored_dirs.clear();
+    counted_links.clear();
+    link_keys.clear();
+    focus_dir = INVALID_NODE;
+}
+
+void TreeWatcher::focus(NodeId dir) {
+    focus_dir = dir;
+
+    if (mode == Backend::Fanotify) {
+        // Crossing into another filesystem needs a mark of its own
+        const Node& node = store[dir];
+        if (!(node.flags & NODE_VIRTUAL)) {
+            mark_filesystem(store.path(dir));
+        }
+        return;
+    }
+    if (mode != Backend::Inotify) {
+        return;
+    }
+
+    // Nearest levels first, so a small budget still covers what is on screen
+    std::vector<NodeId> wanted{dir};
+    for (size_t i = 0; i < wanted.size() && wanted.size() < INOTIFY_WATCH_BUDGET; ++i) {
+        store.for_each_child(wanted[i], [&](NodeId child) {
+            const Node& node = store[child];
+            if (node.is_directory() && !node.is_symlink() && wanted.size() < INOTIFY_WATCH_BUDGET) {
+                wanted.push_back(child);
+            }
+        });
+    }
+
+    // Drop watches first: re-adding an inode that is still watched would
+    // hand back the old descriptor
+    std::unordered_set<NodeId> keep(wanted.begin(), wanted.end());
+    std::vector<NodeId> stale;
+    for (const auto& [node, wd] : node_watches) {
+        if (!keep.count(node)) {
+            stale.push_back(node);
+        }
+    }
+    for (NodeId node : stale) {
+        remove_watch(node);
+    }
+    for (NodeId node : wanted) {
+        if (!(store[node].flags & NODE_VIRTUAL) && !node_watches.count(node)) {
+            if (!add_watch(node) && node_watches.size() >= INOTIFY_WATCH_BUDGET) {
+                break;
+            }
+        }
+    }
+}
+
+bool TreeWatcher::poll(WatchChanges& changes) {
+    changes.dirs.clear();
+    changes.removed.clear();
+
+    if (mode == Backend::Fanotify) {
+        read_fanotify();
+    } else if (mode == Backend::Inotify) {
+        read_inotify();
+    } else {
+        return false;
+    }
+
+    if (!pending.empty()) {
+        apply_pending(changes);
+    }
+    return !changes.empty();
+}
+
+void TreeWatcher::queue(NodeId dir, std::string_view name) {
+    Pending& entry = pending[dir];
+    if (entry.relist) {
+        return;
+    }
+    if (entry.names.size() >= MAX_PENDING_NAMES) {
+        entry.names.clear();
+        entry.relist = true;
+        return;
+    }
+    entry.names.emplace_back(name);
+}
+
+void TreeWatcher::relist_all() {
+    // Events were lost; list whatever can be affected again
+    if (mode == Backend::Inotify) {
+        for (const auto& [node, wd] : node_watches) {
+            pending[node].relist = true;
+        }
+    } else if (focus_dir != INVALID_NODE && !(store[focus_dir].flags & NODE_VIRTUAL)) {
+        pending[focus_dir].relist = true;
+    }
+}
+
+void TreeWatcher::apply_pending(WatchChanges& changes) {
+    auto work = std::move(pending);
+    pending.clear();
+    files_by_mtime.clear();
+    files_indexed = false;
+
+    for (auto& [dir, entry] : work) {
+        // Events can still arrive for directories that were removed or replaced
+        if (store.attached(dir) && !is_excluded(dir)) {
+            update_directory(dir, std::move(entry.names), entry.relist, changes);
+        }
+    }
+}
+
+void TreeWatcher::seed_links(NodeId top) {
+    // The scan only flags hard links, so their inodes are looked up once
+    if (config.count_hard_links) return;
+    std::vector<NodeId> stack{top};
+    while (!stack.empty()) {
+        NodeId id = stack.back();
+        stack.pop_back();
+        const Node& node = store[id];
+        if (node.is_directory() && !node.is_symlink()) {
+            store.for_each_child(id, [&](NodeId child) {
+                stack.push_back(child);
+            });
+        } else if ((node.flags & NODE_HARDLINK) && !(node.flags & NODE_DUPLICATE)) {
+            EntryStat st;
+            if (stat_entry(store.path(id), st) && st.type == DirEntryType::Regular) {
+                InodeKey key{static_cast<uint64_t>(st.device), static_cast<uint64_t>(st.inode)};
+                counted_links[key] = id;
+                link_keys[id] = key;
+            }
+        }
+    }
+}
+
+bool TreeWatcher::claim_inode(NodeId id, const EntryStat& st) {
+    // Whatever inode this name held before is no longer counted through it
+    auto held = link_keys.find(id);
+    if (held != link_keys.end()) {
+        auto owner = counted_links.find(held->second);
+        if (owner != counted_links.end() && owner->second == id) {
+            counted_links.erase(owner);
+        }
+        link_keys.erase(held);
+    }
+
+    Node& node = store[id];
+    node.set_flag(NODE_HARDLINK, st.nlink > 1);
+    if (st.nlink <= 1) {
+        return true;
+    }
+
+    InodeKey key{static_cast<uint64_t>(st.device), static_cast<uint64_t>(st.inode)};
+    auto known = counted_links.find(key);
+    NodeId owner = (known != counted_links.end() && store.attached(known->second)) 
+                   ? known->second : INVALID_NODE;
+    if (owner == INVALID_NODE) {
+        // A name the scan counted while it was still the only one
+        EntryStat found;
+        owner = find_inode(key, st.mtime_sec, id, false, found);
+        if (owner != INVALID_NODE) {
+            store[owner].set_flag(NODE_HARDLINK, true);
+            link_keys[owner] = key;
+        }
+    }
+    if (owner != INVALID_NODE && owner != id) {
+        counted_links[key] = owner;
+        return false;
+    }
+    counted_links[key] = id;
+    link_keys[id] = key;
+    return true;
+}
+
+void TreeWatcher::release_inode(NodeId id, WatchChanges& changes) {
+    auto held = link_keys.find(id);
+    if (held == link_keys.end()) return;
+    InodeKey key = held->second;
+    link_keys.erase(held);
+    auto owner = counted_links.find(key);
+    if (owner == counted_links.end() || owner->second != id) return;
+    counted_links.erase(owner);
+
+    // Another name of the file now counts it, if the tree has one
+    EntryStat st;
+    NodeId heir = find_inode(key, store[id].mtime, id, true, st);
+    if (heir == INVALID_NODE) return;
+    Node& node = store[heir];
+    node.set_flag(NODE_DUPLICATE, false);
+    uint64_t size = config.apparent_size ? st.size : get_size_on_disk(st);
+    store.apply_delta(heir, static_cast<int64_t>(size), size > 0 ? 1 : 0);
+    counted_links[key] = heir;
+    link_keys[heir] = key;
+    changes.dirs.push_back(node.parent);
+}
+
+NodeId TreeWatcher::find_inode(const InodeKey& key, int64_t mtime, NodeId except,
+                               bool duplicate, EntryStat& st) {
+    // Nodes keep no inode, so names with the same mtime are stat'ed
+    if (!files_indexed) {
+        std::vector<NodeId> stack(roots.begin(), roots.end());
+        while (!stack.empty()) {
+            NodeId id = stack.back();
+            stack.pop_back();
+            const Node& node = store[id];
+            if (node.is_directory() && !node.is_symlink()) {
+                store.for_each_child(id, [&](NodeId child) {
+                    stack.push_back(child);
+                });
+            } else if (!node.is_symlink()) {
+                files_by_mtime.emplace(node.mtime, id);
+            }
+        }
+        files_indexed = true;
+    }
+
+    auto range = files_by_mtime.equal_range(mtime);
+    for (auto it = range.first; it != range.second; ++it) {
+        NodeId id = it->second;
+        const Node& node = store[id];
+        if (id == except || ((node.flags & NODE_DUPLICATE) != 0) != duplicate ||
+            !store.attached(id)) {
+            continue;
+        }
+        if (stat_entry(store.path(id), st) && st.type == DirEntryType::Regular &&
+            static_cast<uint64_t>(st.device) == key.device &&
+            static_cast<uint64_t>(st.inode) == key.inode) {
+            return id;
+        }
+    }
+    return INVALID_NODE;
+}
+
+bool TreeWatcher::is_ignored(uint64_t device, uint64_t inode) const {
+    for (const auto& ignored : ignored_dirs) {
+        if (ignored.device == device && ignored.inode == inode) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool TreeWatcher::is_excluded(NodeId dir) const {
+    if (excluded.empty()) return false;
+    for (NodeId id = dir; id != INVALID_NODE; id = store[id].parent) {
+        if (std::find(excluded.begin(), excluded.end(), id) != excluded.end()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void TreeWatcher::update_directory(NodeId top, std::vector<std::string> names, bool relist,
+                                   WatchChanges& changes) {
+    struct Item {
+        NodeId dir;
+        std::vector<std::string> names;
+        bool relist;
+    };
+
+    // New directories are listed in full, which may turn up more of them
+    std::vector<Item> work;
+    work.push_back({top, std::move(names), relist});
+
+    while (!work.empty()) {
+        Item item = std::move(work.back());
+        work.pop_back();
+        const NodeId dir = item.dir;
+        const Node& dir_node = store[dir];
+        if (!dir_node.is_directory() || dir_node.is_symlink() || (dir_node.flags & NODE_VIRTUAL)) {
+            continue;
+        }
+
+        const fs::path dir_path = store.path(dir);
+        DirListing listing;
+        int dir_fd = -1;
+        if (item.relist) {
+            if (!listing.read(dir_path)) continue;
+            dir_fd = listing.fd();
+            listing.for_each([&](const DirRecord& record) {
+                item.names.emplace_back(record.name);
+            });
+        } else {
+            dir_fd = open(dir_path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        }
+        if (dir_fd < 0) {
+            // Gone or unreadable; its parent hears about a removal itself
+            continue;
+        }
+
+        struct stat dir_st;
+        if (fstat(dir_fd, &dir_st) != 0 ||
+            is_ignored(static_cast<uint64_t>(dir_st.st_dev), static_cast<uint64_t>(dir_st.st_ino))) {
+            if (!item.relist) close(dir_fd);
+            continue;
+        }
+
+        std::unordered_map<std::string_view, NodeId> children;
+        store.for_each_child(dir, [&](NodeId child) {
+            children.emplace(store.name(child), child);
+        });
+        if (item.relist) {
+            for (const auto& [name, child] : children) {
+                item.names.emplace_back(name);
+            }
+        }
+        std::sort(item.names.begin(), item.names.end());
+        item.names.erase(std::unique(item.names.begin(), item.names.end()), item.names.end());
+
+        bool changed = false;
+        for (const auto& name : item.names) {
+            EntryStat st;
+            bool exists = stat_entry_at(dir_fd, name.c_str(), st);
+            if (!exists && errno != ENOENT && errno != ENOTDIR) {
+                continue;   // Unreadable for now, keep what the scan saw
+            }
+            if (exists && st.type != DirEntryType::Symlink && config.stay_on_filesystem &&
+                st.device != dir_st.st_dev) {
+                exists = false;
+            }
+            if (exists && st.type == DirEntryType::Other) {
+                exists = false;
+            }
+
+            auto it = children.find(name);
+            NodeId child = (it != children.end()) ? it->second : INVALID_NODE;
+
+            if (child != INVALID_NODE) {
+                const Node& old = store[child];
+                bool same_kind = exists &&
+                    (st.type == DirEntryType::Symlink ? old.is_symlink() :
+                     st.type == DirEntryType::Directory ? (old.is_directory() && !old.is_symlink()) :
+                     !(old.is_directory() || old.is_symlink()));
+                if (!same_kind) {
+                    store.apply_delta(dir, -static_cast<int64_t>(old.size),
+                                      -static_cast<int64_t>(old.entry_count));
+                    store.unlink_child(dir, child);
+                    release_inode(child, changes);
+                    changes.removed.push_back(child);
+                    children.erase(it);
+                    child = INVALID_NODE;
+                    changed = true;
+                }
+            }
+            if (!exists) {
+                continue;
+            }
+
+            if (st.type == DirEntryType::Symlink) {
+                if (child == INVALID_NODE) {
+                    child = store.create(SIZE_MAX, dir, name, NODE_SYMLINK);
+                    char target[4096];
+                    ssize_t len = readlinkat(dir_fd, name.c_str(), target, sizeof(target));
+                    if (len >= 0) {
+                        store.set_symlink_target(SIZE_MAX, child, std::string_view(target, len));
+                    }
+                    children.emplace(store.name(child), child);
+                    changed = true;
+                }
+                continue;
+            }
+
+            if (st.type == DirEntryType::Directory) {
+                if (child == INVALID_NODE) {
+                    child = store.create(SIZE_MAX, dir, name, NODE_DIRECTORY);
+                    store[child].mtime = st.mtime_sec;
+                    children.emplace(store.name(child), child);
+                    if (!is_ignored(static_cast<uint64_t>(st.device), static_cast<uint64_t>(st.inode))) {
+                        if (mode == Backend::Inotify && node_watches.count(dir)) {
+                            add_watch(child);
+                        }
+                        work.push_back({child, {}, true});
+                    }
+                    changed = true;
+                } else if (store[child].mtime != st.mtime_sec) {
+                    store[child].mtime = st.mtime_sec;
+                    changed = true;
+                }
+                continue;
+            }
+
+            if (child == INVALID_NODE) {
+                child = store.create(SIZE_MAX, dir, name, 0);
+                children.emplace(store.name(child), child);
+                changed = true;
+            }
+            Node& node = store[child];
+            if (node.mtime != st.mtime_sec) {
+                node.mtime = st.mtime_sec;
+                changed = true;
+            }
+            if (!config.count_hard_links && !claim_inode(child, st)) {
+                // Its inode is counted under another name
+                if (!(node.flags & NODE_DUPLICATE)) {
+                    store.apply_delta(child, -static_cast<int64_t>(node.size),
+                                      -static_cast<int64_t>(node.entry_count));
+                    node.set_flag(NODE_DUPLICATE, true);
+                    changed = true;
+                }
+                continue;
+            }
+            if (node.flags & NODE_DUPLICATE) {
+                node.set_flag(NODE_DUPLICATE, false);
+                changed = true;
+            }
+
+            uint64_t size = config.apparent_size ? st.size : get_size_on_disk(st);
+            uint32_t entries = size > 0 ? 1 : 0;
+            if (size != node.size || entries != node.entry_count) {
+                int64_t size_delta = static_cast<int64_t>(size - node.size);
+                int64_t count_delta = static_cast<int64_t>(entries) - node.entry_count;
+                store.apply_delta(child, size_delta, count_delta);
+                changed = true;
+            }
+        }
+
+        if (!item.relist) {
+            close(dir_fd);
+        }
+        if (changed) {
+            changes.dirs.push_back(dir);
+        }
+    }
+}
+
+#ifdef __linux__
+bool TreeWatcher::start_fanotify(std::string& error) {
+    fd = fanotify_init(FAN_CLASS_NOTIF | FAN_CLOEXEC | FAN_NONBLOCK | FAN_REPORT_DFID_NAME,
+                       O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        error = std::string("fanotify: ") + std::strerror(errno);
+        return false;
+    }
+
+    for (size_t i = 0; i < roots.size(); ++i) {
+        if (!store[roots[i]].is_directory()) continue;
+        if (!mark_filesystem(store.path(roots[i]))) {
+            error = std::string("fanotify: ") + std::strerror(errno);
+            close(fd);
+            fd = -1;
+            return false;
+        }
+    }
+    return true;
+}
+
+bool TreeWatcher::mark_filesystem(const fs::path& path) {
+    int dir_fd = open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir_fd < 0) {
+        return false;
+    }
+
+    struct statfs sfs;
+    uint64_t fsid = 0;
+    if (fstatfs(dir_fd, &sfs) != 0) {
+        close(dir_fd);
+        return false;
+    }
+    std::memcpy(&fsid, &sfs.f_fsid, sizeof(fsid));
+    if (mount_fds.count(fsid)) {
+        close(dir_fd);
+        return true;
+    }
+
+    const uint64_t mask = FAN_CREATE | FAN_DELETE | FAN_MOVED_FROM | FAN_MOVED_TO |
+                          FAN_MODIFY | FAN_ONDIR;
+    if (fanotify_mark(fd, FAN_MARK_ADD | FAN_MARK_FILESYSTEM, mask, dir_fd, nullptr) != 0) {
+        int saved = errno;
+        close(dir_fd);
+        errno = saved;
+        return false;
+    }
+
+    // Events name directories by handle, which is only useful if the
+    // handle can be opened again (CAP_DAC_READ_SEARCH)
+    union {
+        file_handle handle;
+        char buffer[sizeof(file_handle) + MAX_HANDLE_SZ];
+    } probe;
+    probe.handle.handle_bytes = MAX_HANDLE_SZ;
+    int mount_id;
+    int opened = -1;
+    if (name_to_handle_at(dir_fd, "", &probe.handle, &mount_id, AT_EMPTY_PATH) == 0) {
+        opened = open_by_handle_at(dir_fd, &probe.handle, O_PATH | O_CLOEXEC);
+    }
+    if (opened < 0) {
+        int saved = errno;
+        fanotify_mark(fd, FAN_MARK_REMOVE | FAN_MARK_FILESYSTEM, mask, dir_fd, nullptr);
+        close(dir_fd);
+        errno = saved;
+        return false;
+    }
+    close(opened);
+
+    mount_fds[fsid] = dir_fd;
+    return true;
+}
+
+NodeId TreeWatcher::resolve_handle(uint64_t fsid, const void* data) {
+    // Event records are only 4-byte aligned, so the header is copied out
+    file_handle handle;
+    std::memcpy(&handle, data, sizeof(handle));
+    const char* bytes = static_cast<const char*>(data) + sizeof(file_handle);
+    std::string key(reinterpret_cast<const char*>(&fsid), sizeof(fsid));
+    key.append(reinterpret_cast<const char*>(&handle.handle_type), sizeof(handle.handle_type));
+    key.append(bytes, handle.handle_bytes);
+
+    auto cached = handle_nodes.find(key);
+    if (cached != handle_nodes.end() &&
+        (cached->second == INVALID_NODE || store.attached(cached->second))) {
+        return cached->second;
+    }
+
+    auto mount = mount_fds.find(fsid);
+    if (mount == mount_fds.end()) {
+        return INVALID_NODE;
+    }
+
+    // open_by_handle_at wants a mutable handle
+    std::vector<char> copy(sizeof(file_handle) + handle.handle_bytes);
+    std::memcpy(copy.data(), data, copy.size());
+    int dir_fd = open_by_handle_at(mount->second, reinterpret_cast<file_handle*>(copy.data()),
+                                   O_PATH | O_CLOEXEC);
+    if (dir_fd < 0) {
+        return INVALID_NODE;
+    }
+
+    char link[32];
+    char target[PATH_MAX];
+    std::snprintf(link, sizeof(link), "/proc/self/fd/%d", dir_fd);
+    ssize_t len = readlink(link, target, sizeof(target));
+    close(dir_fd);
+    if (len <= 0) {
+        return INVALID_NODE;
+    }
+
+    bool inside = false;
+    NodeId id = lookup_path(std::string(target, len), inside);
+    // Directories under a root that have no node yet get one once their
+    // parent's events are applied, so only outside ones are remembered
+    if (id != INVALID_NODE || !inside) {
+        if (handle_nodes.size() >= MAX_CACHED_HANDLES) {
+            handle_nodes.clear();
+        }
+        handle_nodes[key] = id;
+    }
+    return id;
+}
+
+NodeId TreeWatcher::lookup_path(const std::string& path, bool& inside) const {
+    inside = false;
+    for (size_t i = 0; i < roots.size(); ++i) {
+        const std::string& base = root_paths[i];
+        if (base.empty() || path.compare(0, base.size(), base) != 0) continue;
+
+        size_t pos = base.size();
+        if (pos < path.size() && base != "/") {
+            if (path[pos] != '/') continue;
+            pos++;
+        }
+        inside = true;
+
+        NodeId node = roots[i];
+        while (pos < path.size() && node != INVALID_NODE) {
+            size_t end = path.find('/', pos);
+            if (end == std::string::npos) end = path.size();
+            std::string_view component(path.data() + pos, end - pos);
+
+            NodeId found = INVALID_NODE;
+            store.for_each_child(node, [&](NodeId child) {
+                const Node& entry = store[child];
+                if (found == INVALID_NODE && entry.is_directory() && !entry.is_symlink() &&
+                    store.name(child) == component) {
+                    found = child;
+                }
+            });
+            node = found;
+            pos = end + 1;
+        }
+        return node;
+    }
+    return INVALID_NODE;
+}
+
+void TreeWatcher::read_fanotify() {
+    char buffer[64 * 1024];
+    bool overflowed = false;
+
+    for (;;) {
+        ssize_t len = read(fd, buffer, sizeof(buffer));
+        if (len <= 0) break;
+
+        // Records with DFID_NAME info are only 4-byte aligned, so headers
+        // are copied out rather than read in place
+        size_t offset = 0;
+        while (offset + sizeof(fanotify_event_metadata) <= static_cast<size_t>(len)) {
+            fanotify_event_metadata meta;
+            std::memcpy(&meta, buffer + offset, sizeof(meta));
+            if (meta.event_len < sizeof(meta) || meta.event_len > len - offset) {
+                break;
+            }
+            const char* event = buffer + offset;
+            offset += meta.event_len;
+
+            if (meta.vers != FANOTIFY_METADATA_VERSION) {
+                return;
+            }
+            if (meta.fd >= 0) {
+                close(meta.fd);
+            }
+            if (meta.mask & FAN_Q_OVERFLOW) {
+                overflowed = true;
+                continue;
+            }
+
+            fanotify_event_info_fid info;
+            if (meta.event_len < sizeof(meta) + sizeof(info) + sizeof(file_handle)) {
+                continue;
+            }
+            std::memcpy(&info, event + sizeof(meta), sizeof(info));
+            if (info.hdr.info_type != FAN_EVENT_INFO_TYPE_DFID_NAME) {
+                continue;
+            }
+            const char* handle = event + sizeof(meta) + sizeof(info);
+            file_handle head;
+            std::memcpy(&head, handle, sizeof(head));
+            const char* name = handle + sizeof(file_handle) + head.handle_bytes;
+            if (name >= event + meta.event_len || name[0] == '\0' || 
+                (name[0] == '.' && name[1] == '\0')) {
+                continue;
+            }
+
+            uint64_t fsid;
+            std::memcpy(&fsid, &info.fsid, sizeof(fsid));
+            NodeId dir = resolve_handle(fsid, handle);
+            if (dir != INVALID_NODE) {
+                queue(dir, name);
+            }
+        }
+    }
+
+    if (overflowed) {
+        relist_all();
+    }
+}
+
+bool TreeWatcher::start_inotify(std::string& error) {
+    fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd < 0) {
+        error = std::string("inotify: ") + std::strerror(errno);
+        return false;
+    }
+    return true;
+}
+
+bool TreeWatcher::add_watch(NodeId dir) {
+    if (node_watches.size() >= INOTIFY_WATCH_BUDGET) {
+        return false;
+    }
+
+    const uint32_t mask = IN_CREATE | IN_DELETE | IN_MODIFY | IN_MOVED_FROM | IN_MOVED_TO |
+                          IN_ONLYDIR | IN_DONT_FOLLOW | IN_EXCL_UNLINK;
+    int wd = inotify_add_watch(fd, store.path(dir).c_str(), mask);
+    if (wd < 0) {
+        return false;
+    }
+
+    // Same inode under another node (a stale one, or a bind mount)
+    auto it = watch_nodes.find(wd);
+    if (it != watch_nodes.end() && it->second != dir) {
+        node_watches.erase(it->second);
+    }
+    watch_nodes[wd] = dir;
+    node_watches[dir] = wd;
+    return true;
+}
+
+void TreeWatcher::remove_watch(NodeId dir) {
+    auto it = node_watches.find(dir);
+    if (it == node_watches.end()) {
+        return;
+    }
+    inotify_rm_watch(fd, it->second);
+    watch_nodes.erase(it->second);
+    node_watches.erase(it);
+}
+
+void TreeWatcher::read_inotify() {
+    alignas(inotify_event) char buffer[64 * 1024];
+    bool overflowed = false;
+
+    for (;;) {
+        ssize_t len = read(fd, buffer, sizeof(buffer));
+        if (len <= 0) break;
+
+        for (char* pos = buffer; pos < buffer + len;) {
+            auto* event = reinterpret_cast<inotify_event*>(pos);
+            pos += sizeof(inotify_event) + event->len;
+
+            if (event->mask & IN_Q_OVERFLOW) {
+                overflowed = true;
+                continue;
+            }
+            auto it = watch_nodes.find(event->wd);
+            if (it == watch_nodes.end()) {
+                continue;
+            }
+            if (event->mask & IN_IGNORED) {
+                // The directory went away (or its filesystem did)
+                node_watches.erase(it->second);
+                watch_nodes.erase(it);
+                continue;
+            }
+            if (event->len > 0) {
+                queue(it->second, event->name);
+            }
+        }
+    }
+
+    if (overflowed) {
+        relist_all();
+    }
+}
+#else
+bool TreeWatcher::start_fanotify(std::string& error) {
+    error = "fanotify unavailable";
+    return false;
+}
+
+bool TreeWatcher::mark_filesystem(const fs::path&) { return false; }
+NodeId TreeWatcher::resolve_handle(uint64_t, const void*) { return INVALID_NODE; }
+NodeId TreeWatcher::lookup_path(const std::string&, bool& inside) const {
+    inside = false;
+    return INVALID_NODE;
+}
+void TreeWatcher::read_fanotify() {}
+
+bool TreeWatcher::start_inotify(std::string& error) {
+    error = "inotify unavailable";
+    return false;
+}
+
+bool TreeWatcher::add_watch(NodeId) { return false; }
+void TreeWatcher::remove_watch(NodeId) {}
+void TreeWatcher::read_inotify() {}
+#endif
@@ -0,0 +1,132 @@
+// dua_watch.h - Following filesystem changes while browsing
+#ifndef DUA_WATCH_H
+#define DUA_WATCH_H
+
+#include "dua_tree.h"
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+
+struct Config;
+struct EntryStat;
+
+// What one poll did to the tree
+struct WatchChanges {
+    std::vector<NodeId> dirs;       // Directories whose entries were updated
+    std::vector<NodeId> removed;    // Entries taken out of their parent
+
+    bool empty() const { return dirs.empty() && removed.empty(); }
+};
+
+// Applies changes below the scanned roots to the tree as size deltas on
+// the changed entries and their ancestors. A fanotify filesystem mark sees
+// the whole tree but needs CAP_SYS_ADMIN; otherwise inotify watches the
+// directory being viewed and as much of the subtree below it as the watch
+// budget allows.
+class TreeWatcher {
+public:
+    enum class Backend { None, Fanotify, Inotify };
+    static constexpr size_t INOTIFY_WATCH_BUDGET = 4096;
+    static constexpr size_t MAX_PENDING_NAMES = 4096;   // Per directory, then it is relisted
+    static constexpr size_t MAX_CACHED_HANDLES = 65536;
+
+private:
+    struct Pending {
+        std::vector<std::string> names;
+        bool relist = false;
+    };
+
+    struct InodeKey {
+        uint64_t device;
+        uint64_t inode;
+
+        bool operator==(const InodeKey& other) const {
+            return device == other.device && inode == other.inode;
+        }
+    };
+    struct InodeKeyHash {
+        size_t operator()(const InodeKey& key) const {
+            return std::hash<uint64_t>()(key.inode * 0x9E3779B97F4A7C15ULL ^ key.device);
+        }
+    };
+
+    NodeStore& store;
+    const Config& config;
+    Backend mode = Backend::None;
+    int fd = -1;
+    std::vector<NodeId> roots;
+    std::vector<std::string> root_paths;    // Canonical, for resolving fanotify handles
+    std::vector<InodeKey> ignored_dirs;
+    NodeId focus_dir = INVALID_NODE;
+    std::unordered_map<NodeId, Pending> pending;
+    std::vector<NodeId> excluded;
+
+    // Hard-linked files: the node each inode is counted under, and the
+    // inode each such node was last seen with
+    std::unordered_map<InodeKey, NodeId, InodeKeyHash> counted_links;
+    std::unordered_map<NodeId, InodeKey> link_keys;
+    // Files by mtime, indexed once per poll that has to look for the
+    // other names of a hard-linked file
+    std::unordered_multimap<int64_t, NodeId> files_by_mtime;
+    bool files_indexed = false;
+
+    // inotify watch descriptors, both ways
+    std::unordered_map<int, NodeId> watch_nodes;
+    std::unordered_map<NodeId, int> node_watches;
+
+    // fanotify: one open directory per marked filesystem (by fsid), for
+    // open_by_handle_at, and directory handles resolved so far
+    std::unordered_map<uint64_t, int> mount_fds;
+    std::unordered_map<std::string, NodeId> handle_nodes;
+
+    bool start_fanotify(std::string& error);
+    bool mark_filesystem(const fs::path& path);
+    NodeId resolve_handle(uint64_t fsid, const void* handle);
+    NodeId lookup_path(const std::string& path, bool& inside) const;
+    void read_fanotify();
+
+    bool start_inotify(std::string& error);
+    bool add_watch(NodeId dir);
+    void remove_watch(NodeId dir);
+    void read_inotify();
+
+    void queue(NodeId dir, std::string_view name);
+    void relist_all();
+    void apply_pending(WatchChanges& changes);
+    void update_directory(NodeId dir, std::vector<std::string> names, bool relist,
+                          WatchChanges& changes);
+    void seed_links(NodeId top);
+    // Whether id is the name its file is counted under
+    bool claim_inode(NodeId id, const EntryStat& st);
+    void release_inode(NodeId id, WatchChanges& changes);
+    NodeId find_inode(const InodeKey& key, int64_t mtime, NodeId except, bool duplicate,
+                      EntryStat& st);
+    bool is_ignored(uint64_t device, uint64_t inode) const;
+    bool is_excluded(NodeId dir) const;
+
+public:
+    TreeWatcher(NodeStore& nodes, const Config& cfg);
+    ~TreeWatcher();
+    TreeWatcher(const TreeWatcher&) = delete;
+    TreeWatcher& operator=(const TreeWatcher&) = delete;
+
+    // Start following the trees under root_entries, preferring fanotify.
+    // Restarting drops everything known about the previous tree.
+    bool start(const std::vector<NodeId>& root_entries, std::string& error);
+    void stop();
+    // The directory now being viewed; inotify moves its watches there
+    void focus(NodeId dir);
+    // dir's children were replaced by a rescan
+    void subtree_replaced(NodeId dir) { seed_links(dir); }
+    // Subtrees whose changes are accounted for elsewhere (being deleted)
+    void set_excluded(std::vector<NodeId> dirs) { excluded = std::move(dirs); }
+    // Read pending events without blocking and fold them into the tree
+    bool poll(WatchChanges& changes);
+
+    Backend backend() const { return mode; }
+    bool active() const { return mode != Backend::None; }
+    size_t watch_count() const { return node_watches.size(); }
+};
+
+#endif // DUA_WATCH_H